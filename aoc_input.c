@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "aoc_input.h"
 
 #define INPUT_FILE_PATH_SIZE sizeof("dayXX.txt")
@@ -6,25 +7,35 @@
 struct _AocInputReader {
     GObject parent;
     FILE *file;
+    GMappedFile *mapped;
+    const char *data;   // contents of mapped
+    size_t data_len;
+    size_t data_pos;
     char *buffer;
     size_t buff_used;
     size_t buff_capacity;
+    char *chunk;        // AOC_INPUT_CHUNK_SIZE bytes, see next_chunk
+    size_t chunk_next;  // start of the bytes carried to the next chunk
+    size_t chunk_carry;
 };
 
 G_DEFINE_TYPE(AocInputReader, aoc_input_reader, G_TYPE_OBJECT)
 
-AocInputReader *
-aoc_input_reader_new(const char *dayXX) {
-    char path[INPUT_FILE_PATH_SIZE];
+static bool
+input_path(const char *func, const char *dayXX, char *path) {
     int rc = snprintf(path, INPUT_FILE_PATH_SIZE, "%s.txt", dayXX);
     if (rc < 0 || rc >= INPUT_FILE_PATH_SIZE) {
-        fprintf(stderr, "%s: error formatting input file path (%s.txt)\n", __func__, dayXX);
-        return NULL;
+        fprintf(stderr, "%s: error formatting input file path (%s.txt)\n", func, dayXX);
+        return false;
     }
+    return true;
+}
 
+static AocInputReader *
+reader_new_file(const char *func, const char *path) {
     FILE *f = fopen(path, "r");
     if (f == NULL) {
-        fprintf(stderr, "%s: can't open file '%s'\n", __func__, path);
+        fprintf(stderr, "%s: can't open file '%s'\n", func, path);
         return NULL;
     }
 
@@ -33,13 +44,146 @@ aoc_input_reader_new(const char *dayXX) {
     return self;
 }
 
+AocInputReader *
+aoc_input_reader_new(const char *dayXX) {
+    char path[INPUT_FILE_PATH_SIZE];
+    if (!input_path(__func__, dayXX, path))
+        return NULL;
+    return reader_new_file(__func__, path);
+}
+
+AocInputReader *
+aoc_input_reader_new_path(const char *path) {
+    return reader_new_file(__func__, path);
+}
+
+AocInputReader *
+aoc_input_reader_new_mapped(const char *dayXX) {
+    char path[INPUT_FILE_PATH_SIZE];
+    if (!input_path(__func__, dayXX, path))
+        return NULL;
+
+    GError *error = NULL;
+    GMappedFile *mapped = g_mapped_file_new(path, FALSE, &error);
+    if (mapped == NULL) {
+        fprintf(stderr, "%s: can't map file '%s': %s\n", __func__, path, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    AocInputReader *self = g_object_new(AOC_TYPE_INPUT_READER, NULL);
+    self->mapped = mapped;
+    self->data_len = g_mapped_file_get_length(mapped);
+    // empty files are not mapped
+    self->data = self->data_len > 0 ? g_mapped_file_get_contents(mapped) : "";
+    return self;
+}
+
+const char *
+aoc_input_reader_get_data(AocInputReader *self, size_t *len) {
+    g_return_val_if_fail(self->mapped != NULL, NULL);
+    *len = self->data_len;
+    return self->data;
+}
+
+const char *
+aoc_input_reader_next_slice(AocInputReader *self, char delim, size_t *len) {
+    g_return_val_if_fail(self->mapped != NULL, NULL);
+    if (self->data_pos >= self->data_len)
+        return NULL;
+
+    const char *start = self->data + self->data_pos;
+    size_t left = self->data_len - self->data_pos;
+    const char *end = memchr(start, delim, left);
+    *len = end != NULL ? (size_t)(end - start) : left;
+    self->data_pos += end != NULL ? *len + 1 : *len;
+    return start;
+}
+
+/* next_chunk for the mapped mode: slices of the mapped file */
+static const char *
+next_chunk_mapped(AocInputReader *self, char delim, size_t *len) {
+    size_t left = self->data_len - self->data_pos;
+    if (left == 0)
+        return NULL;
+
+    const char *chunk = self->data + self->data_pos;
+    size_t end = MIN(left, AOC_INPUT_CHUNK_SIZE);
+    if (delim != '\0' && end < left) {
+        size_t last = end;
+        while (last > 0 && chunk[last - 1] != delim)
+            last--;
+        if (last > 0)
+            end = last;
+    }
+
+    self->data_pos += end;
+    *len = end;
+    return chunk;
+}
+
+const char *
+aoc_input_reader_next_chunk(AocInputReader *self, char delim, size_t *len) {
+    if (self->mapped != NULL)
+        return next_chunk_mapped(self, delim, len);
+
+    if (self->chunk == NULL)
+        self->chunk = g_malloc(AOC_INPUT_CHUNK_SIZE);
+
+    // the incomplete token of the last chunk goes first
+    memmove(self->chunk, self->chunk + self->chunk_next, self->chunk_carry);
+    size_t want = AOC_INPUT_CHUNK_SIZE - self->chunk_carry;
+    size_t got = fread(self->chunk + self->chunk_carry, 1, want, self->file);
+    size_t n = self->chunk_carry + got;
+    if (n == 0)
+        return NULL;
+
+    // at the end of the file, the last token doesn't need a delimiter
+    size_t end = n;
+    if (delim != '\0' && got == want) {
+        size_t last = n;
+        while (last > 0 && self->chunk[last - 1] != delim)
+            last--;
+        if (last > 0)
+            end = last;
+    }
+
+    self->chunk_next = end;
+    self->chunk_carry = n - end;
+    *len = end;
+    return self->chunk;
+}
+
 char *
 aoc_input_reader_getline(AocInputReader *self) {
     return aoc_input_reader_getdelim(self, '\n');
 }
 
+/* getdelim for the mapped mode: copy the next slice to the buffer */
+static char *
+getdelim_mapped(AocInputReader *self, char delim) {
+    size_t len;
+    const char *slice = aoc_input_reader_next_slice(self, delim, &len);
+    if (slice == NULL)
+        return NULL;
+
+    if (len + 1 > self->buff_capacity) {
+        self->buffer = realloc(self->buffer, len + 1);
+        if (self->buffer == NULL)
+            return NULL;
+        self->buff_capacity = len + 1;
+    }
+    memcpy(self->buffer, slice, len);
+    self->buffer[len] = '\0';
+    self->buff_used = len;
+    return self->buffer;
+}
+
 char *
 aoc_input_reader_getdelim(AocInputReader *self, char delim) {
+    if (self->mapped != NULL)
+        return getdelim_mapped(self, delim);
+
     ssize_t rc = getdelim(&self->buffer, &self->buff_capacity, delim, self->file);
     if (rc == -1)
         return NULL;
@@ -68,8 +212,12 @@ aoc_input_reader_finalize(GObject *gobj) {
     g_assert(AOC_IS_INPUT_READER(gobj));
 
     AocInputReader *self = AOC_INPUT_READER(gobj);
-    fclose(self->file);
+    if (self->file != NULL)
+        fclose(self->file);
+    if (self->mapped != NULL)
+        g_mapped_file_unref(self->mapped);
     free(self->buffer);
+    g_free(self->chunk);
     G_OBJECT_CLASS(aoc_input_reader_parent_class)->finalize(&self->parent);
 }
 
@@ -81,7 +229,12 @@ aoc_input_reader_class_init(AocInputReaderClass *class) {
 
 static void
 aoc_input_reader_init(AocInputReader *self) {
+    self->file = NULL;
+    self->mapped = NULL;
     self->buffer = NULL;
+    self->chunk = NULL;
+    self->chunk_next = 0;
+    self->chunk_carry = 0;
 }
 
 long
@@ -94,6 +247,169 @@ aoc_input_parse_num(const char *str) {
     return val;
 }
 
+static inline bool
+is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+#ifdef __GNUC__
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_WIDTH 32
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCAN_WIDTH 16
+#endif
+#endif
+
+#ifdef SCAN_WIDTH
+/* Bit mask of the bytes equal to delim among the SCAN_WIDTH bytes at p */
+static inline guint32
+delim_mask(const char *p, char delim) {
+#if SCAN_WIDTH == 32
+    __m256i block = _mm256_loadu_si256((const __m256i *)p);
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(delim)));
+#else
+    __m128i block = _mm_loadu_si128((const __m128i *)p);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(delim)));
+#endif
+}
+#endif
+
+/*
+ * Convert the 8 digits at p at once, as the lanes of a 64 bits integer.
+ * Return false if any of them is not a digit.
+ */
+static inline bool
+parse_8_digits(const char *p, guint64 *val) {
+    guint64 x;
+    memcpy(&x, p, sizeof(x));
+    x = GUINT64_FROM_LE(x);
+    // digits are 0x30..0x39: adding 6 must not carry out of the low nibble
+    if (((x & 0xF0F0F0F0F0F0F0F0) | (((x + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) !=
+        0x3333333333333333)
+        return false;
+
+    x -= 0x3030303030303030;
+    x = x * 10 + (x >> 8); // pairs of digits in the even bytes
+    x = ((x & 0x000000FF000000FF) * (100 + (1000000ull << 32)) +
+         ((x >> 16) & 0x000000FF000000FF) * (1 + (10000ull << 32))) >> 32;
+    *val = x;
+    return true;
+}
+
+/* Parse the number in data[start..end) checking every char, for errors and big numbers */
+static bool
+parse_token_slow(const char *data, size_t start, size_t end, long *val, size_t *err_offset) {
+    size_t i = start;
+    bool neg = i < end && data[i] == '-';
+    if (i < end && (data[i] == '-' || data[i] == '+'))
+        i++;
+
+    size_t digits = i;
+    unsigned long uval = 0;
+    bool overflow = false;
+    while (i < end && data[i] >= '0' && data[i] <= '9') {
+        overflow |= __builtin_mul_overflow(uval, 10, &uval) ||
+                    __builtin_add_overflow(uval, data[i] - '0', &uval);
+        i++;
+    }
+
+    if (i == digits || i != end || overflow || uval > (unsigned long)LONG_MAX + neg) {
+        *err_offset = i;
+        return false;
+    }
+    *val = neg ? (long)(0 - uval) : (long)uval;
+    return true;
+}
+
+/* Parse the number in data[start..end), 8 digits at a time */
+static inline bool
+parse_token(const char *data, size_t start, size_t end, long *val, size_t *err_offset) {
+    const char *p = data + start;
+    size_t n = end - start;
+    bool neg = n > 0 && *p == '-';
+    if (n > 0 && (*p == '-' || *p == '+')) {
+        p++;
+        n--;
+    }
+    // up to 18 digits can't overflow
+    if (n == 0 || n > 18)
+        return parse_token_slow(data, start, end, val, err_offset);
+
+    guint64 acc = 0, chunk;
+    for (; n >= 8; n -= 8, p += 8) {
+        if (!parse_8_digits(p, &chunk))
+            return parse_token_slow(data, start, end, val, err_offset);
+        acc = acc * 100000000 + chunk;
+    }
+    for (; n > 0; n--, p++) {
+        unsigned digit = (unsigned char)*p - '0';
+        if (digit > 9)
+            return parse_token_slow(data, start, end, val, err_offset);
+        acc = acc * 10 + digit;
+    }
+
+    *val = neg ? -(long)acc : (long)acc;
+    return true;
+}
+
+typedef struct {
+    GArray *values;
+    size_t len;
+} NumList;
+
+static inline bool
+num_list_add(NumList *list, const char *data, size_t start, size_t end, size_t *err_offset) {
+    if (list->len == list->values->len)
+        g_array_set_size(list->values, list->values->len * 2);
+    return parse_token(data, start, end, &g_array_index(list->values, long, list->len++), err_offset);
+}
+
+GArray *
+aoc_input_parse_num_list(const char *data, size_t len, char delim, size_t *err_offset) {
+    while (len > 0 && is_space(data[len - 1]))
+        len--;
+
+    // numbers take at least 2 bytes with the delimiter, but they're usually longer:
+    // guess, and grow the array if needed
+    NumList list = {.values = g_array_sized_new(FALSE, FALSE, sizeof(long), len / 4 + 1)};
+    g_array_set_size(list.values, len / 4 + 1);
+
+    size_t err, start = 0, i = 0;
+#ifdef SCAN_WIDTH
+    // find the delimiters of a whole block at once, and parse the numbers in between
+    for (; i + SCAN_WIDTH <= len; i += SCAN_WIDTH) {
+        guint32 mask = delim_mask(data + i, delim);
+        while (mask != 0) {
+            size_t end = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (!num_list_add(&list, data, start, end, &err))
+                goto error;
+            start = end + 1;
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        if (data[i] != delim)
+            continue;
+        if (!num_list_add(&list, data, start, i, &err))
+            goto error;
+        start = i + 1;
+    }
+    if (len > 0 && !num_list_add(&list, data, start, len, &err))
+        goto error;
+
+    g_array_set_size(list.values, list.len);
+    return list.values;
+
+error:
+    if (err_offset != NULL)
+        *err_offset = err < len ? err : len - 1;
+    g_array_free(list.values, TRUE);
+    return NULL;
+}
+
 GArray *
 aoc_input_split_char(char *str, const char *delim, GArray *out_arr) {
     if (out_arr == NULL)
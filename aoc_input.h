@@ -3,8 +3,12 @@
 
 #include <glib-object.h>
 #include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #define PARSE_NUM_ERR LONG_MIN
+/* Size of the chunks returned by aoc_input_reader_next_chunk */
+#define AOC_INPUT_CHUNK_SIZE (64 * 1024)
 
 #define AOC_TYPE_INPUT_READER (aoc_input_reader_get_type())
 G_DECLARE_FINAL_TYPE(AocInputReader, aoc_input_reader, AOC, INPUT_READER, GObject)
@@ -15,6 +19,49 @@ G_DECLARE_FINAL_TYPE(AocInputReader, aoc_input_reader, AOC, INPUT_READER, GObjec
 AocInputReader *
 aoc_input_reader_new(const char *dayXX);
 
+/**
+ * Create a reader of any file, not only of the AOC inputs
+ */
+AocInputReader *
+aoc_input_reader_new_path(const char *path);
+
+/**
+ * Create an AOC input file reader that maps the whole file in memory, to read
+ * it without copies with aoc_input_reader_get_data and
+ * aoc_input_reader_next_slice. getline/getdelim also work, copying each
+ * token.
+ */
+AocInputReader *
+aoc_input_reader_new_mapped(const char *dayXX);
+
+/**
+ * Return the whole contents of a mapped reader, of length len. They are not
+ * NUL terminated, and they are valid while the reader is alive.
+ */
+const char *
+aoc_input_reader_get_data(AocInputReader *reader, size_t *len);
+
+/**
+ * Return the next token of a mapped reader, of length len, up to the
+ * delimiter delim (not included) or the end of the file. Return NULL at the
+ * end of the file. The token points into the mapped file: it is not NUL
+ * terminated, and it can't be modified.
+ */
+const char *
+aoc_input_reader_next_slice(AocInputReader *reader, char delim, size_t *len);
+
+/**
+ * Return the next chunk of the file, of length len and at most
+ * AOC_INPUT_CHUNK_SIZE bytes, or NULL at the end of the file. Memory use
+ * doesn't depend on the size of the file.
+ * If delim is not '\0', chunks end just after a delimiter: the incomplete
+ * token at the end of a read is carried to the start of the next chunk.
+ * Only tokens longer than a chunk are split. The chunk is not NUL terminated,
+ * and it's valid until the next call. Don't mix it with getline/getdelim.
+ */
+const char *
+aoc_input_reader_next_chunk(AocInputReader *reader, char delim, size_t *len);
+
 /**
  * Return the next line, or NULL on error.
  * The InputReader keeps the ownership. Increase the refcount of the string or
@@ -46,6 +93,15 @@ aoc_input_reader_steal_buffer(AocInputReader *reader);
 long
 aoc_input_parse_num(const char *str);
 
+/**
+ * Parse a list of numbers separated by delim, like "1,-2,3", from the len
+ * bytes of data, and return them in a GArray of long. Trailing whitespace is
+ * ignored. Return NULL if any of them is invalid, with the position of the
+ * error in err_offset if it's not NULL.
+ */
+GArray *
+aoc_input_parse_num_list(const char *data, size_t len, char delim, size_t *err_offset);
+
 /**
  * Split the string str at any of the chars contained by the string delim.
  * Append the tokens to the out_arr array. If out_arr is NULL, it is created.
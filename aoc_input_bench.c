@@ -0,0 +1,112 @@
+#include "aoc_input.h"
+#include "aoc_error.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_INPUT_SIZE (64 * 1024 * 1024)
+#define BENCH_RUNS 5
+
+typedef GArray *parse_fn(const char *data, size_t len, char delim);
+
+/*
+ * A list of numbers like the inputs: Intcode programs (small numbers and
+ * some big or negative ones, separated by commas) or masses (6 digits
+ * numbers, one per line)
+ */
+static GString *
+generate_input(char delim) {
+    GString *str = g_string_sized_new(BENCH_INPUT_SIZE + 32);
+    GRand *rand = g_rand_new_with_seed(2019);
+
+    while (str->len < BENCH_INPUT_SIZE) {
+        long val;
+        if (delim == '\n')
+            val = g_rand_int_range(rand, 100000, 1000000);
+        else if (g_rand_int_range(rand, 0, 8) == 0)
+            val = (long)g_rand_int(rand) * g_rand_int_range(rand, -100000, 100000);
+        else
+            val = g_rand_int_range(rand, 0, 10000);
+
+        if (str->len > 0)
+            g_string_append_c(str, delim);
+        g_string_append_printf(str, "%ld", val);
+    }
+
+    g_rand_free(rand);
+    return str;
+}
+
+/* The old way: split the tokens and parse each one with strtol */
+static GArray *
+parse_strtol(const char *data, size_t len, char delim) {
+    char *buff = g_strndup(data, len);
+    char delims[] = {delim, '\0'};
+    GArray *tokens = aoc_input_split_char(buff, delims, NULL);
+    GArray *values = g_array_new(FALSE, FALSE, sizeof(long));
+
+    for (size_t i = 0; i < tokens->len; i++) {
+        long val = aoc_input_parse_num(g_array_index(tokens, char *, i));
+        if (val == PARSE_NUM_ERR)
+            aoc_die("Parse number error: %s\n", g_array_index(tokens, char *, i));
+        g_array_append_val(values, val);
+    }
+
+    g_array_free(tokens, TRUE);
+    g_free(buff);
+    return values;
+}
+
+static GArray *
+parse_bulk(const char *data, size_t len, char delim) {
+    size_t err_offset;
+    GArray *values = aoc_input_parse_num_list(data, len, delim, &err_offset);
+    if (values == NULL)
+        aoc_die("Parse number error at offset %zu\n", err_offset);
+    return values;
+}
+
+/* Return the best time of BENCH_RUNS runs, in seconds */
+static double
+bench(parse_fn parse, const GString *input, char delim, GArray **result) {
+    gint64 best = G_MAXINT64;
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        gint64 start = g_get_monotonic_time();
+        GArray *values = parse(input->str, input->len, delim);
+        best = MIN(best, g_get_monotonic_time() - start);
+
+        if (i == 0)
+            *result = values;
+        else
+            g_array_free(values, TRUE);
+    }
+    return (double)best / G_USEC_PER_SEC;
+}
+
+int
+main(int argc, char **argv) {
+    const char delims[] = {',', '\n'};
+
+    for (size_t i = 0; i < sizeof(delims); i++) {
+        GString *input = generate_input(delims[i]);
+        GArray *expect = NULL, *values = NULL;
+
+        double strtol_secs = bench(parse_strtol, input, delims[i], &expect);
+        double bulk_secs = bench(parse_bulk, input, delims[i], &values);
+        if (values->len != expect->len ||
+            memcmp(values->data, expect->data, values->len * sizeof(long)) != 0)
+            aoc_die("Parsers results differ\n");
+
+        double mb = (double)input->len / (1024 * 1024);
+        printf("%s separated, %.0f MB, %u numbers: strtol %.1f MB/s, bulk %.1f MB/s (x%.1f)\n",
+               delims[i] == ',' ? "comma" : "newline", mb, values->len,
+               mb / strtol_secs, mb / bulk_secs, strtol_secs / bulk_secs);
+
+        g_array_free(expect, TRUE);
+        g_array_free(values, TRUE);
+        g_string_free(input, TRUE);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,40 +1,198 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "aoc_input.h"
+#include "aoc_error.h"
 
-static long
-calc_recursive(long val) {
-    val = val / 3 - 2;
-    if (val >= 0)
-        return val + calc_recursive(val);
-    else
-        return 0;
+#ifdef __GNUC__
+#ifdef __SSE2__
+#include <emmintrin.h>
+#define FUEL_SIMD 1
+#endif
+#endif
+
+#define FUEL_BLOCK 8
+#define FUEL_MIN_PER_THREAD (1024 * 1024)
+
+typedef struct {
+    long part1;
+    long part2;
+} Fuel;
+
+static inline void
+fuel_one(long mass, Fuel *fuel) {
+    fuel->part1 += mass / 3 - 2;
+    for (long val = mass; (val = val / 3 - 2) > 0;)
+        fuel->part2 += val;
+}
+
+#ifdef FUEL_SIMD
+/* x / 3 for 4 lanes of 32 bits: the high half of x * ceil(2^33 / 3), 2 lanes at a time */
+static inline __m128i
+div3_epu32(__m128i x) {
+    const __m128i magic = _mm_set1_epi32((int)0xAAAAAAAB);
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(x, magic), 33);
+    __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), magic), 33);
+    return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+/* x - 2, or 0 if it's negative. x / 3 < 2^31, so a signed compare works */
+static inline __m128i
+minus2_epi32(__m128i x) {
+    __m128i positive = _mm_cmpgt_epi32(x, _mm_set1_epi32(1));
+    return _mm_and_si128(_mm_sub_epi32(x, _mm_set1_epi32(2)), positive);
+}
+
+/* The low 32 bits of 4 longs, that must fit in them */
+static inline __m128i
+load_4_masses(const long *masses) {
+    __m128i lo = _mm_loadu_si128((const __m128i *)masses);
+    __m128i hi = _mm_loadu_si128((const __m128i *)(masses + 2));
+    return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+/* Add the 4 unsigned lanes of 32 bits of x to the 2 lanes of 64 bits of sum */
+static inline __m128i
+add_widened(__m128i sum, __m128i x) {
+    __m128i zero = _mm_setzero_si128();
+    sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(x, zero));
+    return _mm_add_epi64(sum, _mm_unpackhi_epi32(x, zero));
+}
+
+static inline long
+hsum_epi64(__m128i x) {
+    gint64 lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, x);
+    return lanes[0] + lanes[1];
+}
+#endif
+
+/*
+ * Add the fuel of the masses, FUEL_BLOCK at a time in SIMD lanes if possible.
+ * The fuel of a module is the sum of a geometric series, that fits in 32 bits
+ * if the mass does. Masses that don't, or negative ones, are done one by one.
+ */
+static void
+fuel_batch(const long *masses, size_t n, Fuel *fuel) {
+    size_t i = 0;
+
+#ifdef FUEL_SIMD
+    __m128i sum1 = _mm_setzero_si128(), sum2 = _mm_setzero_si128();
+    size_t n_simd = 0;
+    for (; i + FUEL_BLOCK <= n; i += FUEL_BLOCK) {
+        unsigned long high = 0;
+        for (size_t j = 0; j < FUEL_BLOCK; j++)
+            high |= (unsigned long)masses[i + j] >> 32;
+        if (high != 0) {
+            for (size_t j = 0; j < FUEL_BLOCK; j++)
+                fuel_one(masses[i + j], fuel);
+            continue;
+        }
+
+        __m128i a = div3_epu32(load_4_masses(masses + i));
+        __m128i b = div3_epu32(load_4_masses(masses + i + 4));
+        sum1 = add_widened(add_widened(sum1, a), b);
+        n_simd += FUEL_BLOCK;
+
+        // until the fuel of all the lanes needs no more fuel, 2 steps at a time
+        __m128i total_a = _mm_setzero_si128(), total_b = _mm_setzero_si128();
+        a = minus2_epi32(a);
+        b = minus2_epi32(b);
+        while (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_or_si128(a, b), _mm_setzero_si128())) != 0xFFFF) {
+            total_a = _mm_add_epi32(total_a, a);
+            total_b = _mm_add_epi32(total_b, b);
+            a = minus2_epi32(div3_epu32(a));
+            b = minus2_epi32(div3_epu32(b));
+            total_a = _mm_add_epi32(total_a, a);
+            total_b = _mm_add_epi32(total_b, b);
+            a = minus2_epi32(div3_epu32(a));
+            b = minus2_epi32(div3_epu32(b));
+        }
+        sum2 = add_widened(add_widened(sum2, total_a), total_b);
+    }
+    fuel->part1 += hsum_epi64(sum1) - 2 * (long)n_simd;
+    fuel->part2 += hsum_epi64(sum2);
+#endif
+
+    for (; i < n; i++)
+        fuel_one(masses[i], fuel);
+}
+
+typedef struct {
+    const long *masses;
+    size_t n;
+    Fuel fuel;
+    GThread *thread;
+} FuelWorker;
+
+static gpointer
+fuel_worker_run(gpointer data) {
+    FuelWorker *worker = data;
+    fuel_batch(worker->masses, worker->n, &worker->fuel);
+    return NULL;
+}
+
+/* fuel_batch split in n_threads threads, if there are enough masses */
+static Fuel
+fuel_parallel(const long *masses, size_t n, guint n_threads) {
+    n_threads = MIN(n_threads, MAX(n / FUEL_MIN_PER_THREAD, 1));
+    FuelWorker *workers = g_new0(FuelWorker, n_threads);
+    for (guint i = 0; i < n_threads; i++) {
+        size_t begin = n * i / n_threads, end = n * (i + 1) / n_threads;
+        workers[i].masses = masses + begin;
+        workers[i].n = end - begin;
+        if (n_threads > 1)
+            workers[i].thread = g_thread_new("fuel", fuel_worker_run, &workers[i]);
+        else
+            fuel_worker_run(&workers[i]);
+    }
+
+    Fuel fuel = {0, 0};
+    for (guint i = 0; i < n_threads; i++) {
+        if (workers[i].thread != NULL)
+            g_thread_join(workers[i].thread);
+        fuel.part1 += workers[i].fuel.part1;
+        fuel.part2 += workers[i].fuel.part2;
+    }
+    g_free(workers);
+    return fuel;
 }
 
 #ifndef TEST
 
+static gint opt_threads = 0;
+
+static GOptionEntry options[] = {
+    {"threads", 't', 0, G_OPTION_ARG_INT, &opt_threads, "Number of worker threads (default: number of CPUs)", "N"},
+    {NULL}
+};
+
 int
 main(int argc, char **argv) {
-    long total_part1 = 0;
-    long total_part2 = 0;
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- The Tyranny of the Rocket Equation");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+        aoc_die("Option parsing failed: %s\n", error->message);
+    g_option_context_free(context);
 
-    AocInputReader *reader = aoc_input_reader_new("day01");
+    AocInputReader *reader = aoc_input_reader_new_mapped("day01");
     if (reader == NULL)
         return EXIT_FAILURE;
 
-    char *line;
-    while ((line = aoc_input_reader_getline(reader)) != NULL) {
-        long val = aoc_input_parse_num(line);
-        if (val == PARSE_NUM_ERR)
-            return EXIT_FAILURE;
+    size_t len, err_offset;
+    const char *data = aoc_input_reader_get_data(reader, &len);
+    GArray *masses = aoc_input_parse_num_list(data, len, '\n', &err_offset);
+    if (masses == NULL)
+        aoc_die("Parse number error at offset %zu\n", err_offset);
 
-        total_part1 += val / 3 - 2;
-        total_part2 += calc_recursive(val);
-    }
+    guint n_threads = opt_threads > 0 ? (guint)opt_threads : g_get_num_processors();
+    Fuel fuel = fuel_parallel((const long *)masses->data, masses->len, n_threads);
 
-    printf("Part 1: total fuel = %ld\n", total_part1);
-    printf("Part 2: total fuel = %ld\n", total_part2);
+    printf("Part 1: total fuel = %ld\n", fuel.part1);
+    printf("Part 2: total fuel = %ld\n", fuel.part2);
 
+    g_array_free(masses, TRUE);
     g_object_unref(reader);
     return EXIT_SUCCESS;
 }
@@ -42,6 +200,16 @@ main(int argc, char **argv) {
 
 #else
 
+/* The reference for the fuel of part 2, computed recursively */
+static long
+calc_recursive(long val) {
+    val = val / 3 - 2;
+    if (val >= 0)
+        return val + calc_recursive(val);
+    else
+        return 0;
+}
+
 void
 test_recursive_calc() {
     g_assert_cmpint(calc_recursive(14), ==, 2);
@@ -49,11 +217,44 @@ test_recursive_calc() {
     g_assert_cmpint(calc_recursive(100756), ==, 50346);
 }
 
+void
+test_fuel_batch() {
+    // small, big and negative masses, and the limits of the SIMD lanes
+    long special[] = {0, 1, 5, 6, 8, 9, 14, 1969, 100756, -1, -100, 4294967295, 4294967296, 1L << 40};
+    GArray *masses = g_array_new(FALSE, FALSE, sizeof(long));
+    for (long i = 0; i < 1000; i++) {
+        long mass = i % 3 == 0 ? special[i / 3 % G_N_ELEMENTS(special)] : i * 7919 % 200000;
+        g_array_append_val(masses, mass);
+    }
+    // and only masses that fit in the lanes
+    for (long i = 0; i < 1000; i++) {
+        long mass = i % 100 == 0 ? 4294967295 : i * 2654435761 % 4294967296;
+        g_array_append_val(masses, mass);
+    }
+
+    for (size_t n = 0; n <= masses->len; n += n < 40 ? 1 : 97) {
+        Fuel expect = {0, 0};
+        for (size_t i = 0; i < n; i++) {
+            long mass = g_array_index(masses, long, i);
+            expect.part1 += mass / 3 - 2;
+            expect.part2 += calc_recursive(mass);
+        }
+
+        Fuel fuel = {0, 0};
+        fuel_batch((const long *)masses->data, n, &fuel);
+        g_assert_cmpint(fuel.part1, ==, expect.part1);
+        g_assert_cmpint(fuel.part2, ==, expect.part2);
+    }
+
+    g_array_free(masses, TRUE);
+}
+
 int
 main(int argc, char **argv) {
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/day01/test_recursive_calc", test_recursive_calc);
+    g_test_add_func("/day01/test_fuel_batch", test_fuel_batch);
 
     return g_test_run();
 }
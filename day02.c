@@ -1,67 +1,325 @@
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <glib.h>
 #include "aoc_input.h"
-
-enum ops {
-    OP_ADD = 1,
-    OP_MUL = 2,
-    OP_HALT = 99
-};
+#include "intcode.h"
+
+#define BATCH_LANES 256
+#define PART2_OUTPUT 19690720
+#define POLY_DEG 4
+// limit of the symbolic search, when the loop of part2 would never end
+#define SYMBOLIC_MAX (1l << 24)
+
+/*
+ * Polynomial in the noun (x) and the verb (y): c[i][j] is the coefficient of
+ * x^i * y^j. A value read from an address that depends on them is unknown.
+ */
+typedef struct {
+    long c[POLY_DEG + 1][POLY_DEG + 1];
+    bool unknown;
+} Poly;
 
 static void
-solve(long *values) {
-    size_t pos = 0;
-
-    long op;
-    while ((op = values[pos]) != OP_HALT) {
-        long *input1 = &values[values[pos + 1]];
-        long *input2 = &values[values[pos + 2]];
-        long *dest = &values[values[pos + 3]];
-
-        if (op == OP_ADD) {
-            *dest = *input1 + *input2;
-        } else if (op == OP_MUL) {
-            *dest = *input1 * *input2;
-        } else {
-            fprintf(stderr, "Invalid operand '%ld' at pos '%lu'\n", op, (unsigned long)pos);
-            exit(EXIT_FAILURE);
-        }
-
-        pos += 4;
+solve(GArray *values) {
+    Intcode computer;
+    intcode_init(&computer, values);
+
+    IntcodeState rc = intcode_run(&computer);
+    if (rc != STATE_HALT) {
+        fprintf(stderr, "Invalid operand '%ld' at pos '%ld'\n",
+                intcode_mem_get(&computer, computer.ip), computer.ip);
+        exit(EXIT_FAILURE);
     }
+
+    for (size_t i = 0; i < values->len; i++)
+        g_array_index(values, long, i) = intcode_mem_get(&computer, i);
+
+    intcode_deinit(&computer);
 }
 
 void
 part1(GArray *values) {
     g_array_index(values, long, 1) = 12;
     g_array_index(values, long, 2) = 2;
-    solve((long *)values->data);
+    solve(values);
 
     printf("Part 1: pos0 = %ld\n", g_array_index(values, long, 0));
     g_array_free(values, TRUE);
 }
 
+static long
+solve_with(Intcode *computer, long val1, long val2) {
+    intcode_reset(computer);
+    intcode_mem_set(computer, 1, val1);
+    intcode_mem_set(computer, 2, val2);
+
+    if (intcode_run(computer) != STATE_HALT) {
+        fprintf(stderr, "Invalid operand '%ld' at pos '%ld'\n",
+                intcode_mem_get(computer, computer->ip), computer->ip);
+        exit(EXIT_FAILURE);
+    }
+
+    return intcode_mem_get(computer, 0);
+}
+
+/*
+ * Try all the (val1, val2) candidates at once in the lanes of batch, in
+ * order. Return the lane of the first one that gives 19690720, or -1.
+ * Lanes that the batch can't finish (they write beyond the program) are run
+ * again with the full interpreter.
+ */
+static long
+try_batch(IntcodeBatch *batch, Intcode *computer, const long (*candidates)[2], size_t n) {
+    intcode_batch_reset(batch);
+    for (size_t lane = 0; lane < n; lane++) {
+        intcode_batch_mem_set(batch, lane, 1, candidates[lane][0]);
+        intcode_batch_mem_set(batch, lane, 2, candidates[lane][1]);
+    }
+    intcode_batch_run(batch);
+
+    for (size_t lane = 0; lane < n; lane++) {
+        long result = batch->state[lane] == STATE_HALT ?
+                      intcode_batch_mem_get(batch, lane, 0) :
+                      solve_with(computer, candidates[lane][0], candidates[lane][1]);
+        if (result == PART2_OUTPUT)
+            return lane;
+    }
+    return -1;
+}
+
+static void
+poly_const(Poly *p, long val) {
+    memset(p, 0, sizeof(Poly));
+    p->c[0][0] = val;
+}
+
+static bool
+poly_is_const(const Poly *p, long *val) {
+    if (p->unknown)
+        return false;
+    for (int i = 0; i <= POLY_DEG; i++) {
+        for (int j = 0; j <= POLY_DEG; j++) {
+            if ((i || j) && p->c[i][j] != 0)
+                return false;
+        }
+    }
+    *val = p->c[0][0];
+    return true;
+}
+
+static void
+poly_add(const Poly *a, const Poly *b, Poly *res) {
+    Poly sum = {.unknown = a->unknown || b->unknown};
+    for (int i = 0; i <= POLY_DEG && !sum.unknown; i++) {
+        for (int j = 0; j <= POLY_DEG; j++)
+            sum.unknown |= __builtin_add_overflow(a->c[i][j], b->c[i][j], &sum.c[i][j]);
+    }
+    *res = sum;
+}
+
+static void
+poly_mul(const Poly *a, const Poly *b, Poly *res) {
+    Poly prod = {.unknown = a->unknown || b->unknown};
+    for (int i = 0; i <= POLY_DEG && !prod.unknown; i++) {
+        for (int j = 0; j <= POLY_DEG && !prod.unknown; j++) {
+            if (a->c[i][j] == 0)
+                continue;
+            for (int k = 0; k <= POLY_DEG && !prod.unknown; k++) {
+                for (int l = 0; l <= POLY_DEG && !prod.unknown; l++) {
+                    if (b->c[k][l] == 0)
+                        continue;
+                    long term;
+                    // terms of too high degree can't be represented
+                    prod.unknown |= i + k > POLY_DEG || j + l > POLY_DEG ||
+                                    __builtin_mul_overflow(a->c[i][j], b->c[k][l], &term) ||
+                                    __builtin_add_overflow(prod.c[i + k][j + l], term, &prod.c[i + k][j + l]);
+                }
+            }
+        }
+    }
+    *res = prod;
+}
+
+/* Value of the argument n of the instruction at ip, in mode (0 or 1) */
+static bool
+symbolic_arg(Poly *mem, size_t len, long ip, int n, int mode, Poly *val) {
+    if (mode == ARG_MODE_IMM) {
+        *val = mem[ip + n];
+        return true;
+    }
+
+    long addr;
+    if (!poly_is_const(&mem[ip + n], &addr)) {
+        // the address depends on the noun and the verb
+        poly_const(val, 0);
+        val->unknown = true;
+        return true;
+    }
+    if (addr < 0)
+        return false;
+    if ((size_t)addr >= len)
+        poly_const(val, 0);
+    else
+        *val = mem[addr];
+    return true;
+}
+
+/*
+ * Run the program with the noun and the verb as variables, and write in
+ * result the polynomial left at position 0. Return false if the program is
+ * not only additions and multiplications at fixed places: the opcodes or
+ * the write addresses depend on the noun or the verb, or it writes beyond
+ * its end.
+ */
+static bool
+symbolic_run(const GArray *values, Poly *result) {
+    size_t len = values->len;
+    if (len < 3)
+        return false;
+
+    Poly *mem = g_new(Poly, len);
+    for (size_t i = 0; i < len; i++)
+        poly_const(&mem[i], g_array_index(values, long, i));
+    memset(&mem[1], 0, sizeof(Poly));
+    mem[1].c[1][0] = 1;
+    memset(&mem[2], 0, sizeof(Poly));
+    mem[2].c[0][1] = 1;
+
+    bool ok = false;
+    for (long ip = 0; ip >= 0 && (size_t)ip < len; ip += 4) {
+        long insn, dst;
+        if (!poly_is_const(&mem[ip], &insn))
+            break;
+        if (insn == OP_HALT) {
+            *result = mem[0];
+            ok = !result->unknown;
+            break;
+        }
+
+        int op = insn % 100, mode1 = insn / 100 % 10, mode2 = insn / 1000 % 10;
+        if ((op != OP_ADD && op != OP_MUL) || insn >= 10000 || mode1 > 1 || mode2 > 1 ||
+            (size_t)ip + 3 >= len || !poly_is_const(&mem[ip + 3], &dst) ||
+            dst < 0 || (size_t)dst >= len)
+            break;
+
+        Poly a, b;
+        if (!symbolic_arg(mem, len, ip, 1, mode1, &a) || !symbolic_arg(mem, len, ip, 2, mode2, &b))
+            break;
+        if (op == OP_ADD)
+            poly_add(&a, &b, &mem[dst]);
+        else
+            poly_mul(&a, &b, &mem[dst]);
+    }
+
+    g_free(mem);
+    return ok;
+}
+
+/*
+ * Find the first (val1, val2), in the order part2 tries them, for which the
+ * polynomial is PART2_OUTPUT. For each val1 it's a polynomial on val2, that
+ * is solved directly when it's linear. val1 is -1 if there is no solution
+ * below SYMBOLIC_MAX. Return false if the values overflow.
+ */
+static bool
+symbolic_solve(const Poly *p, long *val1, long *val2) {
+    for (long min = 0, max = 32; max <= SYMBOLIC_MAX; min = max, max *= 2) {
+        for (long x = min; x < max; x++) {
+            // coefficients of the polynomial on y
+            long q[POLY_DEG + 1] = {0};
+            bool overflow = false;
+            for (int j = 0; j <= POLY_DEG; j++) {
+                for (int i = POLY_DEG; i >= 0; i--)
+                    overflow |= __builtin_mul_overflow(q[j], x, &q[j]) ||
+                                __builtin_add_overflow(q[j], p->c[i][j], &q[j]);
+            }
+            if (overflow)
+                return false;
+
+            int deg = POLY_DEG;
+            while (deg > 0 && q[deg] == 0)
+                deg--;
+
+            if (deg == 0 && q[0] == PART2_OUTPUT) {
+                *val1 = x;
+                *val2 = 0;
+                return true;
+            }
+            if (deg == 1) {
+                long y = (PART2_OUTPUT - q[0]) / q[1];
+                if ((PART2_OUTPUT - q[0]) % q[1] == 0 && y >= 0 && y < max) {
+                    *val1 = x;
+                    *val2 = y;
+                    return true;
+                }
+            }
+            for (long y = 0; deg > 1 && y < max; y++) {
+                long val = 0;
+                for (int j = deg; j >= 0 && !overflow; j--)
+                    overflow |= __builtin_mul_overflow(val, y, &val) ||
+                                __builtin_add_overflow(val, q[j], &val);
+                if (overflow)
+                    return false;
+                if (val == PART2_OUTPUT) {
+                    *val1 = x;
+                    *val2 = y;
+                    return true;
+                }
+            }
+        }
+    }
+    *val1 = -1;
+    return true;
+}
+
 void
 part2(GArray *original_values) {
-    long *values = calloc(original_values->len, sizeof(long));
-
     long min = 0;
     long max = 32;
 
+    // position 0 as a function of the noun and the verb, without running the
+    // program for each candidate
+    Poly pos0;
+    long val1, val2;
+    if (symbolic_run(original_values, &pos0) && symbolic_solve(&pos0, &val1, &val2)) {
+        if (val1 >= 0)
+            printf("Part 2: result = %ld\n", 100 * val1 + val2);
+        else
+            printf("Part 2: no solution\n");
+        g_array_free(original_values, TRUE);
+        return;
+    }
+
+    // every attempt restarts from the same snapshot, without copying again
+    // the whole program nor decoding again the instructions it didn't modify
+    Intcode base, computer;
+    intcode_init(&base, original_values);
+    IntcodeSnapshot *snap = intcode_snapshot_new(&base);
+    intcode_deinit(&base);
+    intcode_fork(&computer, snap);
+
+    IntcodeBatch batch;
+    intcode_batch_init(&batch, original_values, BATCH_LANES);
+    long candidates[BATCH_LANES][2];
+    size_t n = 0;
+
     while (TRUE) {
         for (long val1 = min; val1 < max; val1++) {
             for (long val2 = 0; val2 < max; val2++) {
-                memcpy(values, original_values->data, original_values->len * sizeof(long));
-                values[1] = val1;
-                values[2] = val2;
-                solve(values);
-
-                if (values[0] == 19690720) {
-                    printf("Part 2: result = %ld\n", 100 * val1 + val2);
+                candidates[n][0] = val1;
+                candidates[n][1] = val2;
+                if (++n < BATCH_LANES && !(val1 == max - 1 && val2 == max - 1))
+                    continue;
+
+                long lane = try_batch(&batch, &computer, (const long (*)[2])candidates, n);
+                if (lane >= 0) {
+                    printf("Part 2: result = %ld\n", 100 * candidates[lane][0] + candidates[lane][1]);
                     goto out;
                 }
+                n = 0;
             }
         }
 
@@ -70,27 +328,26 @@ part2(GArray *original_values) {
     }
 
 out:
+    intcode_batch_deinit(&batch);
+    intcode_deinit(&computer);
+    intcode_snapshot_free(snap);
     g_array_free(original_values, TRUE);
-    free(values);
 }
 
 static GArray *
 parse_input() {
-    AocInputReader *reader = aoc_input_reader_new("day02");
+    AocInputReader *reader = aoc_input_reader_new_mapped("day02");
     if (reader == NULL)
         return NULL;
 
-    GArray *values = g_array_new(FALSE, FALSE, sizeof(long));
-    if (values == NULL)
-        goto out;
-
-    char *token;
-    while ((token = aoc_input_reader_getdelim(reader, ',')) != NULL) {
-        long val = aoc_input_parse_num(token);
-        g_array_append_val(values, val);
+    size_t len, err_offset;
+    const char *data = aoc_input_reader_get_data(reader, &len);
+    GArray *values = aoc_input_parse_num_list(data, len, ',', &err_offset);
+    if (values == NULL) {
+        fprintf(stderr, "Parse number error at offset %zu\n", err_offset);
+        exit(EXIT_FAILURE);
     }
 
-out:
     g_object_unref(reader);
     return values;
 }
@@ -112,7 +369,7 @@ void
 assert_solve(long *input, long *expect, size_t size) {
     GArray *values = g_array_new(FALSE, FALSE, sizeof(long));
     g_array_append_vals(values, input, size);
-    solve((long *)values->data);
+    solve(values);
 
     g_assert_cmpmem(values->data, values->len * sizeof(long), expect, size * sizeof(long));
 }
@@ -145,6 +402,60 @@ test_program() {
     assert_solve(input, expect, sizeof(input) / sizeof(long));
 }
 
+void
+test_symbolic() {
+    // pos3 = pos[noun] + pos[verb], overwritten by pos3 = noun + verb, then
+    // pos0 = pos3 * 7
+    long input[] = {1,0,0,3, 1,1,2,3, 2,3,13,0, 99, 7};
+    GArray *values = g_array_new(FALSE, FALSE, sizeof(long));
+    g_array_append_vals(values, input, sizeof(input) / sizeof(long));
+
+    Poly pos0;
+    long val1, val2;
+    g_assert_true(symbolic_run(values, &pos0));
+    g_assert_cmpint(pos0.c[0][0], ==, 0);
+    g_assert_cmpint(pos0.c[1][0], ==, 7);
+    g_assert_cmpint(pos0.c[0][1], ==, 7);
+    g_assert_cmpint(pos0.c[1][1], ==, 0);
+    g_assert_true(symbolic_solve(&pos0, &val1, &val2));
+    g_assert_cmpint(7 * (val1 + val2), ==, PART2_OUTPUT);
+    g_array_free(values, TRUE);
+}
+
+void
+test_symbolic_unsupported() {
+    // the result is read from an address that depends on the noun
+    long input1[] = {1,1,2,0,99};
+    // the second instruction writes to the address noun + verb
+    long input2[] = {1101,0,0,7, 1,9,9,0, 99,5};
+    GArray *values = g_array_new(FALSE, FALSE, sizeof(long));
+    Poly pos0;
+
+    g_array_append_vals(values, input1, sizeof(input1) / sizeof(long));
+    g_assert_false(symbolic_run(values, &pos0));
+
+    g_array_set_size(values, 0);
+    g_array_append_vals(values, input2, sizeof(input2) / sizeof(long));
+    g_assert_false(symbolic_run(values, &pos0));
+    g_array_free(values, TRUE);
+}
+
+void
+test_parse_num_list() {
+    const char *input = "1,-2,30,9223372036854775807\n";
+    long expect[] = {1,-2,30,LONG_MAX};
+    size_t err_offset;
+    GArray *values = aoc_input_parse_num_list(input, strlen(input), ',', &err_offset);
+    g_assert_nonnull(values);
+    g_assert_cmpmem(values->data, values->len * sizeof(long), expect, sizeof(expect));
+    g_array_free(values, TRUE);
+
+    g_assert_null(aoc_input_parse_num_list("1,2,,3", 6, ',', &err_offset));
+    g_assert_cmpuint(err_offset, ==, 4);
+    g_assert_null(aoc_input_parse_num_list("1,2x", 4, ',', &err_offset));
+    g_assert_cmpuint(err_offset, ==, 3);
+}
+
 int
 main(int argc, char **argv) {
     g_test_init(&argc, &argv, NULL);
@@ -153,6 +464,9 @@ main(int argc, char **argv) {
     g_test_add_func("/day02/test_mul", test_mul);
     g_test_add_func("/day02/test_extra_positions", test_mul);
     g_test_add_func("/day02/test_program", test_program);
+    g_test_add_func("/day02/test_symbolic", test_symbolic);
+    g_test_add_func("/day02/test_symbolic_unsupported", test_symbolic_unsupported);
+    g_test_add_func("/day02/test_parse_num_list", test_parse_num_list);
 
     return g_test_run();
 }
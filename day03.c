@@ -3,149 +3,396 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "aoc_input.h"
+#include "aoc_error.h"
 
-typedef struct _Coord {
-    long x;
-    long y;
-} Coord;
+/*
+ * An horizontal or vertical piece of wire, from lo to hi in one axis at the
+ * fixed position of the other axis. The steps to any point of it are computed
+ * from the steps at the point where the wire enters it.
+ */
+typedef struct {
+    long fixed;             // y for horizontal segments, x for vertical ones
+    long lo;
+    long hi;
+    long start;             // lo or hi, depending on the direction
+    unsigned long steps;    // steps of the wire at start
+    guint wire;
+} Segment;
 
-typedef struct _Move {
-    Coord dir;
-    unsigned long dist;
-} Move;
+/* Best crossings found: the closest to the origin, and the one with fewer steps */
+typedef struct {
+    long min_dist;
+    unsigned long min_steps;
+} Crossings;
 
-static GHashTable * get_visited_points(GArray *moves);
-static GArray * parse_moves(char *line);
-static guint coord_hash(gconstpointer c);
-static gboolean coord_equal(gconstpointer a, gconstpointer b);
+/* Best crossings of each pair of wires a < b, at pairs[a * n_wires + b] */
+typedef struct {
+    guint n_wires;
+    Crossings *pairs;
+} CrossingsTable;
 
-int
-main(int argc, char **argv) {
-    AocInputReader *reader = aoc_input_reader_new("day03");
+/*
+ * A band of the board for one thread: the vertical segments in a range of x,
+ * and the horizontal lines in a range of y
+ */
+typedef struct {
+    const GArray *horizontal;
+    const GArray *vertical;
+    guint h_begin;
+    guint h_end;
+    guint v_begin;
+    guint v_end;
+    CrossingsTable table;
+    GThread *thread;
+} Band;
 
-    char *line1 = aoc_input_reader_getline(reader);
-    if (line1 == NULL)
-        return EXIT_FAILURE;
+enum { EVENT_START, EVENT_QUERY, EVENT_END };
 
-    GArray *moves1 = parse_moves(line1);
-    if (moves1 == NULL)
-        return EXIT_FAILURE;
+/* Sweep line events: horizontal segments start and end, vertical ones query */
+typedef struct {
+    long x;
+    int type;
+    const Segment *seg;
+} Event;
 
-    char *line2 = aoc_input_reader_getline(reader);
-    if (line2 == NULL)
-        return EXIT_FAILURE;
+static inline unsigned long
+segment_steps(const Segment *seg, long pos) {
+    return seg->steps + labs(pos - seg->start);
+}
 
-    GArray *moves2 = parse_moves(line2);
-    if (moves2 == NULL)
-        return EXIT_FAILURE;
+static void
+crossings_table_init(CrossingsTable *self, guint n_wires) {
+    self->n_wires = n_wires;
+    self->pairs = g_new(Crossings, (gsize)n_wires * n_wires);
+    for (gsize i = 0; i < (gsize)n_wires * n_wires; i++)
+        self->pairs[i] = (Crossings){LONG_MAX, ULONG_MAX};
+}
 
-    GHashTable *points1 = get_visited_points(moves1);
-    GHashTable *points2 = get_visited_points(moves2);
+static void
+crossings_table_deinit(CrossingsTable *self) {
+    g_free(self->pairs);
+}
 
-    long min_radial_dist = LONG_MAX;
-    long min_steps = LONG_MAX;
+static void
+crossings_table_merge(CrossingsTable *self, const CrossingsTable *other) {
+    for (gsize i = 0; i < (gsize)self->n_wires * self->n_wires; i++) {
+        self->pairs[i].min_dist = MIN(self->pairs[i].min_dist, other->pairs[i].min_dist);
+        self->pairs[i].min_steps = MIN(self->pairs[i].min_steps, other->pairs[i].min_steps);
+    }
+}
 
-    GHashTableIter iter;
-    gpointer key;
-    g_hash_table_iter_init(&iter, points1);
-    while (g_hash_table_iter_next(&iter, &key, NULL)) {
-        if (g_hash_table_contains(points2, key)) {
-            Coord *coord = (Coord *)key;
+static void
+crossing_add(CrossingsTable *self, guint a, guint b, long x, long y, unsigned long steps) {
+    // the wires start together, it doesn't count
+    if (x == 0 && y == 0)
+        return;
+    Crossings *pair = &self->pairs[(gsize)MIN(a, b) * self->n_wires + MAX(a, b)];
+    pair->min_dist = MIN(pair->min_dist, labs(x) + labs(y));
+    pair->min_steps = MIN(pair->min_steps, steps);
+}
 
-            long radial_dist = labs(coord->x) + labs(coord->y);
-            if (radial_dist < min_radial_dist)
-                min_radial_dist = radial_dist;
+/*
+ * Parse the moves of a wire, like "R8,U5,L5", into its horizontal and vertical
+ * segments
+ */
+static void
+parse_wire(char *line, guint wire, GArray *horizontal, GArray *vertical) {
+    GArray *tokens = aoc_input_split_char(line, ",", NULL);
+    long x = 0, y = 0;
+    unsigned long steps = 0;
 
-            long steps = (unsigned long)g_hash_table_lookup(points1, key) +
-                         (unsigned long)g_hash_table_lookup(points2, key);
-            if (steps < min_steps)
-                min_steps = steps;
+    for (size_t i = 0; i < tokens->len; i++) {
+        char *token = g_array_index(tokens, char *, i);
+        long dist = aoc_input_parse_num(token + 1);
+        if (dist == PARSE_NUM_ERR || dist < 0)
+            aoc_die("Can't parse distance: %s\n", token);
+
+        Segment seg;
+        switch (token[0]) {
+        case 'U': seg = (Segment){x, y, y + dist, y, steps, wire}; y += dist; break;
+        case 'D': seg = (Segment){x, y - dist, y, y, steps, wire}; y -= dist; break;
+        case 'R': seg = (Segment){y, x, x + dist, x, steps, wire}; x += dist; break;
+        case 'L': seg = (Segment){y, x - dist, x, x, steps, wire}; x -= dist; break;
+        default:
+            aoc_die("Invalid direction: %s\n", token);
         }
+        steps += dist;
+        g_array_append_val(token[0] == 'U' || token[0] == 'D' ? vertical : horizontal, seg);
     }
 
-    printf("Part 1: min radial dist = %ld\n", min_radial_dist);
-    printf("Part 2: min steps = %ld\n", min_steps);
+    g_array_free(tokens, TRUE);
+}
 
-    g_hash_table_unref(points1);
-    g_hash_table_unref(points2);
-    g_array_unref(moves1);
-    g_array_unref(moves2);
-    g_object_unref(reader);
-    return EXIT_SUCCESS;
+static gint
+event_cmp(gconstpointer a, gconstpointer b) {
+    const Event *ea = a, *eb = b;
+    if (ea->x != eb->x)
+        return ea->x < eb->x ? -1 : 1;
+    return ea->type - eb->type;
 }
 
-static GHashTable *
-get_visited_points(GArray *moves) {
-    Coord pos = {.x = 0, .y = 0};
-    unsigned long steps = 0;
-    GHashTable *points = g_hash_table_new(coord_hash, coord_equal);
+/* Order of the active horizontal segments: by y, and by address if equal */
+static gint
+active_cmp(gconstpointer a, gconstpointer b, gpointer data) {
+    const Segment *sa = a, *sb = b;
+    if (sa->fixed != sb->fixed)
+        return sa->fixed < sb->fixed ? -1 : 1;
+    return sa < sb ? -1 : sa > sb;
+}
 
-    for (size_t i = 0; i < moves->len; i++) {
-        Move *mov = &g_array_index(moves, Move, i);
+/* Compare only by y, to find the first active segment at a y >= the one of key */
+static gint
+active_search_cmp(gconstpointer a, gconstpointer b, gpointer data) {
+    const Segment *sa = a, *key = b;
+    return sa->fixed < key->fixed ? -1 : 1;
+}
+
+/*
+ * Find the crossings of the horizontal and vertical segments of different
+ * wires with a sweep line over x. The horizontal segments under the line are
+ * kept sorted by y, and each vertical segment takes the ones in its y range.
+ * The vertical segments are sorted by x, only the horizontal segments in
+ * their range of x are swept.
+ */
+static void
+cross_perpendicular(const GArray *horizontal, const Segment *vertical, guint n_vertical, CrossingsTable *table) {
+    long x_lo = vertical[0].fixed, x_hi = vertical[n_vertical - 1].fixed;
+    GArray *events = g_array_new(FALSE, FALSE, sizeof(Event));
+    for (guint i = 0; i < horizontal->len; i++) {
+        const Segment *h = &g_array_index(horizontal, Segment, i);
+        if (h->hi < x_lo || h->lo > x_hi)
+            continue;
+        Event start = {h->lo, EVENT_START, h}, end = {h->hi, EVENT_END, h};
+        g_array_append_val(events, start);
+        g_array_append_val(events, end);
+    }
+    for (guint i = 0; i < n_vertical; i++) {
+        Event query = {vertical[i].fixed, EVENT_QUERY, &vertical[i]};
+        g_array_append_val(events, query);
+    }
+    g_array_sort(events, event_cmp);
 
-        while (mov->dist > 0) {
-            pos.x += mov->dir.x;
-            pos.y += mov->dir.y;
-            steps++;
-            mov->dist--;
+    GSequence *active = g_sequence_new(NULL);
+    GSequenceIter **active_iters = g_new(GSequenceIter *, horizontal->len);
+    for (guint i = 0; i < events->len; i++) {
+        const Event *ev = &g_array_index(events, Event, i);
+        const Segment *seg = ev->seg;
 
-            Coord *key = malloc(sizeof(Coord));
-            *key = pos;
-            if (!g_hash_table_contains(points, key))
-                g_hash_table_insert(points, key, (gpointer)steps);
+        if (ev->type == EVENT_START) {
+            active_iters[seg - (const Segment *)horizontal->data] =
+                g_sequence_insert_sorted(active, (gpointer)seg, active_cmp, NULL);
+        } else if (ev->type == EVENT_END) {
+            g_sequence_remove(active_iters[seg - (const Segment *)horizontal->data]);
+        } else {
+            Segment key = {.fixed = seg->lo};
+            GSequenceIter *it = g_sequence_search(active, &key, active_search_cmp, NULL);
+            for (; !g_sequence_iter_is_end(it); it = g_sequence_iter_next(it)) {
+                const Segment *h = g_sequence_get(it);
+                if (h->fixed > seg->hi)
+                    break;
+                if (h->wire != seg->wire)
+                    crossing_add(table, h->wire, seg->wire, seg->fixed, h->fixed,
+                                 segment_steps(h, seg->fixed) + segment_steps(seg, h->fixed));
+            }
         }
     }
 
-    return points;
+    g_free(active_iters);
+    g_sequence_free(active);
+    g_array_free(events, TRUE);
 }
 
-static GArray *
-parse_moves(char *line) {
-    GArray *tokens = aoc_input_split_char(line, ",", NULL);
-    if (tokens == NULL)
-        return NULL;
+static gint
+segment_cmp(gconstpointer a, gconstpointer b) {
+    const Segment *sa = a, *sb = b;
+    if (sa->fixed != sb->fixed)
+        return sa->fixed < sb->fixed ? -1 : 1;
+    return sa->lo < sb->lo ? -1 : sa->lo > sb->lo;
+}
 
-    GArray *moves = g_array_sized_new(FALSE, FALSE, sizeof(Move), tokens->len);
-    if (moves == NULL)
-        goto out;
+/*
+ * Every point of the overlap [lo, hi] of 2 parallel segments is a crossing.
+ * The steps are linear along it and the distance is minimum at the point
+ * closest to 0, so only the ends and that point are candidates, or the points
+ * next to them if any of them is the origin.
+ */
+static void
+cross_overlap(const Segment *a, const Segment *b, long lo, long hi, CrossingsTable *table) {
+    long mid = CLAMP(0, lo, hi);
+    long candidates[] = {lo, lo + 1, mid - 1, mid, mid + 1, hi - 1, hi};
 
-    size_t i;
-    for (i = 0; i < tokens->len; i++) {
-        char *token = g_array_index(tokens, char *, i);
-        Move mov;
+    for (size_t i = 0; i < G_N_ELEMENTS(candidates); i++) {
+        long pos = CLAMP(candidates[i], lo, hi);
+        crossing_add(table, a->wire, b->wire, pos, a->fixed, segment_steps(a, pos) + segment_steps(b, pos));
+    }
+}
 
-        switch (token[0]) {
-        case 'U': mov.dir.x = 0; mov.dir.y = 1; break;
-        case 'R': mov.dir.x = 1; mov.dir.y = 0; break;
-        case 'D': mov.dir.x = 0; mov.dir.y = -1; break;
-        case 'L': mov.dir.x = -1; mov.dir.y = 0; break;
-        default:
-            fprintf(stderr, "Invalid direction: %s\n", token);
-            exit(EXIT_FAILURE);
-        }
+/*
+ * Find the crossings of parallel segments of different wires that overlap,
+ * in segments sorted by line and start. Coordinates are symmetric for
+ * distance and steps, so it works the same for horizontal and vertical
+ * segments.
+ */
+static void
+cross_parallel(const Segment *segments, guint n_segments, CrossingsTable *table) {
+    // segments on the current line that may still overlap with the next ones
+    GPtrArray *open = g_ptr_array_new();
+    for (guint i = 0; i < n_segments; i++) {
+        const Segment *seg = &segments[i];
 
-        mov.dist = aoc_input_parse_num(token + 1);
-        if (mov.dist == PARSE_NUM_ERR) {
-            fprintf(stderr, "Can't parse distance: %s\n", token);
-            exit(EXIT_FAILURE);
+        guint kept = 0;
+        for (guint j = 0; j < open->len; j++) {
+            const Segment *prev = g_ptr_array_index(open, j);
+            if (prev->fixed != seg->fixed || prev->hi < seg->lo)
+                continue;
+            if (prev->wire != seg->wire)
+                cross_overlap(prev, seg, seg->lo, MIN(prev->hi, seg->hi), table);
+            g_ptr_array_index(open, kept++) = (gpointer)prev;
         }
+        g_ptr_array_set_size(open, kept);
+        g_ptr_array_add(open, (gpointer)seg);
+    }
 
-        g_array_append_val(moves, mov);
+    g_ptr_array_free(open, TRUE);
+}
+
+/*
+ * Split the segments, sorted by line, in n_bands ranges of about the same
+ * size that don't break a line
+ */
+static void
+split_lines(const GArray *segments, guint n_bands, guint *bounds) {
+    bounds[0] = 0;
+    for (guint i = 1; i < n_bands; i++) {
+        guint pos = MAX(bounds[i - 1], (guint)((guint64)segments->len * i / n_bands));
+        while (pos > 0 && pos < segments->len &&
+               g_array_index(segments, Segment, pos).fixed == g_array_index(segments, Segment, pos - 1).fixed)
+            pos++;
+        bounds[i] = pos;
     }
+    bounds[n_bands] = segments->len;
+}
 
-out:
-    g_array_free(tokens, TRUE);
-    return moves;
+static gpointer
+band_run(gpointer data) {
+    Band *band = data;
+    const Segment *h = (const Segment *)band->horizontal->data;
+    const Segment *v = (const Segment *)band->vertical->data;
+
+    if (band->v_end > band->v_begin) {
+        cross_perpendicular(band->horizontal, v + band->v_begin, band->v_end - band->v_begin, &band->table);
+        cross_parallel(v + band->v_begin, band->v_end - band->v_begin, &band->table);
+    }
+    cross_parallel(h + band->h_begin, band->h_end - band->h_begin, &band->table);
+    return NULL;
 }
 
-static guint
-coord_hash(gconstpointer c) {
-    const Coord *coord = c;
-    return ((coord->x & 0xFF) << 16) | (coord->y & 0xFF);
+/*
+ * Find the best crossings of every pair of the n_wires wires, whose segments
+ * are in horizontal and vertical. The board is split in n_threads bands of x
+ * for the vertical segments and of y for the horizontal ones, that are
+ * searched in parallel.
+ */
+static void
+cross_wires(GArray *horizontal, GArray *vertical, guint n_wires, guint n_threads, CrossingsTable *table) {
+    g_array_sort(horizontal, segment_cmp);
+    g_array_sort(vertical, segment_cmp);
+
+    guint *h_bounds = g_new(guint, n_threads + 1);
+    guint *v_bounds = g_new(guint, n_threads + 1);
+    split_lines(horizontal, n_threads, h_bounds);
+    split_lines(vertical, n_threads, v_bounds);
+
+    Band *bands = g_new0(Band, n_threads);
+    for (guint i = 0; i < n_threads; i++) {
+        bands[i] = (Band){
+            .horizontal = horizontal,
+            .vertical = vertical,
+            .h_begin = h_bounds[i],
+            .h_end = h_bounds[i + 1],
+            .v_begin = v_bounds[i],
+            .v_end = v_bounds[i + 1],
+        };
+        crossings_table_init(&bands[i].table, n_wires);
+        if (n_threads > 1)
+            bands[i].thread = g_thread_new("band", band_run, &bands[i]);
+        else
+            band_run(&bands[i]);
+    }
+
+    crossings_table_init(table, n_wires);
+    for (guint i = 0; i < n_threads; i++) {
+        if (bands[i].thread != NULL)
+            g_thread_join(bands[i].thread);
+        crossings_table_merge(table, &bands[i].table);
+        crossings_table_deinit(&bands[i].table);
+    }
+
+    g_free(bands);
+    g_free(h_bounds);
+    g_free(v_bounds);
 }
 
-static gboolean
-coord_equal(gconstpointer a, gconstpointer b) {
-    const Coord *ca = a, *cb = b;
-    return ca->x == cb->x && ca->y == cb->y;
+static gint opt_threads = 0;
+static gboolean opt_pairs = FALSE;
+
+static GOptionEntry options[] = {
+    {"threads", 't', 0, G_OPTION_ARG_INT, &opt_threads, "Number of worker threads (default: number of CPUs)", "N"},
+    {"pairs", 'p', 0, G_OPTION_ARG_NONE, &opt_pairs, "Print the best crossings of every pair of wires", NULL},
+    {NULL}
+};
+
+int
+main(int argc, char **argv) {
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- Crossed Wires");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+        aoc_die("Option parsing failed: %s\n", error->message);
+    g_option_context_free(context);
+
+    AocInputReader *reader = aoc_input_reader_new("day03");
+    if (reader == NULL)
+        return EXIT_FAILURE;
+
+    // one wire per line
+    GArray *horizontal = g_array_new(FALSE, FALSE, sizeof(Segment));
+    GArray *vertical = g_array_new(FALSE, FALSE, sizeof(Segment));
+    guint n_wires = 0;
+    char *line;
+    while ((line = aoc_input_reader_getline(reader)) != NULL) {
+        if (*line != '\0')
+            parse_wire(line, n_wires++, horizontal, vertical);
+    }
+    if (n_wires < 2)
+        aoc_die("The input must have 2 wires at least\n");
+
+    guint n_threads = opt_threads > 0 ? (guint)opt_threads : g_get_num_processors();
+    CrossingsTable table;
+    cross_wires(horizontal, vertical, n_wires, n_threads, &table);
+
+    Crossings best = {LONG_MAX, ULONG_MAX};
+    for (guint a = 0; a < n_wires; a++) {
+        for (guint b = a + 1; b < n_wires; b++) {
+            const Crossings *pair = &table.pairs[(gsize)a * n_wires + b];
+            if (pair->min_dist == LONG_MAX)
+                continue;
+            if (opt_pairs)
+                printf("Wires %u and %u: min radial dist = %ld, min steps = %lu\n",
+                       a + 1, b + 1, pair->min_dist, pair->min_steps);
+            best.min_dist = MIN(best.min_dist, pair->min_dist);
+            best.min_steps = MIN(best.min_steps, pair->min_steps);
+        }
+    }
+    if (best.min_dist == LONG_MAX)
+        aoc_die("The wires don't cross\n");
+
+    printf("Part 1: min radial dist = %ld\n", best.min_dist);
+    printf("Part 2: min steps = %lu\n", best.min_steps);
+
+    crossings_table_deinit(&table);
+    g_array_free(horizontal, TRUE);
+    g_array_free(vertical, TRUE);
+    g_object_unref(reader);
+    return EXIT_SUCCESS;
 }
@@ -1,88 +1,397 @@
+#include "aoc_error.h"
+#include <glib.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
-#define PASSWORD_MIN {2, 4, 8, 3, 4, 5}
-#define PASSWORD_MAX {7, 4, 6, 3, 1, 5}
+#define PASSWORD_MIN "248345"
+#define PASSWORD_MAX "746315"
+#define MAX_DIGITS 18
+#define UNKNOWN UINT64_MAX
+#define MAX_JOBS 4096
+#define JOBS_AHEAD 4    // per thread, not written yet
 
-static bool is_valid_pwd_part1(uint8_t digits[6]);
-static bool is_valid_pwd_part2(uint8_t digits[6]);
-static bool next_pwd(uint8_t digits[6]);
+/* The password must have a run of equal digits of length k or more, or exactly k */
+typedef enum {
+    RUN_AT_LEAST,
+    RUN_EXACTLY,
+} RunRule;
 
-int
-main(int argc, char **argv) {
-    unsigned int valid_pwds_part1 = 0;
-    unsigned int valid_pwds_part2 = 0;
-    uint8_t digits[6] = PASSWORD_MIN;
+/*
+ * Count the passwords of n_digits non decreasing digits that fulfill the rule,
+ * without enumerating them: the passwords that start with a prefix are
+ * counted from its length, last digit and last run, and these counts are
+ * memoised.
+ */
+typedef struct {
+    RunRule rule;
+    unsigned int k;
+    unsigned int n_digits;
+    unsigned int max_run;   // runs are only tracked up to the length that matters
+    // completions by remaining digits, last digit, length of the last run and
+    // whether the rule is already fulfilled
+    guint64 memo[MAX_DIGITS + 1][10][MAX_DIGITS + 1][2];
+} PwdCounter;
 
-    do {
-        if (is_valid_pwd_part1(digits))
-            valid_pwds_part1++;
-        if (is_valid_pwd_part2(digits))
-            valid_pwds_part2++;
-    } while (next_pwd(digits));
+static void
+pwd_counter_init(PwdCounter *self, RunRule rule, unsigned int k, unsigned int n_digits) {
+    self->rule = rule;
+    self->k = k;
+    self->n_digits = n_digits;
+    self->max_run = MIN(rule == RUN_EXACTLY ? k + 1 : k, MAX_DIGITS);
+    memset(self->memo, 0xFF, sizeof(self->memo));
+}
 
-    printf("Part 1: number of valid passwords = %u\n", valid_pwds_part1);
-    printf("Part 2: number of valid passwords = %u\n", valid_pwds_part2);
+/* Whether a run of that length, once finished, fulfills the rule */
+static inline bool
+run_ok(const PwdCounter *self, unsigned int run) {
+    return self->rule == RUN_EXACTLY ? run == self->k : run >= self->k;
 }
 
-static bool
-is_valid_pwd_part1(uint8_t digits[6]) {
-    bool repeated = false;
-    for (size_t i = 0; i < 5; i++) {
-        if (digits[i] > digits[i + 1])
-            return false;
-        else if (digits[i] == digits[i + 1])
-            repeated = true;
+/* Append the digit d to a prefix ending in last, with a last run of length run */
+static inline void
+push_digit(const PwdCounter *self, unsigned int last, unsigned int d, unsigned int *run, bool *ok) {
+    if (*run > 0 && d == last) {
+        *run = MIN(*run + 1, self->max_run);
+    } else {
+        *ok = *ok || run_ok(self, *run);
+        *run = 1;
     }
-    return repeated;
 }
 
-static bool
-is_valid_pwd_part2(uint8_t digits[6]) {
-    for (size_t i = 0; i < 5; i++) {
-        if (digits[i] > digits[i + 1])
-            return false;
+static guint64
+completions(PwdCounter *self, unsigned int remaining, unsigned int last, unsigned int run, bool ok) {
+    if (remaining == 0)
+        return ok || run_ok(self, run);
+
+    guint64 *memo = &self->memo[remaining][last][run][ok];
+    if (*memo != UNKNOWN)
+        return *memo;
+
+    guint64 count = 0;
+    for (unsigned int d = run > 0 ? last : 0; d <= 9; d++) {
+        unsigned int next_run = run;
+        bool next_ok = ok;
+        push_digit(self, last, d, &next_run, &next_ok);
+        count += completions(self, remaining - 1, d, next_run, next_ok);
+    }
+    return *memo = count;
+}
+
+/* Count the valid passwords <= max, of n_digits digits with leading zeros */
+static guint64
+pwd_counter_count_le(PwdCounter *self, guint64 max) {
+    unsigned int digits[MAX_DIGITS];
+    for (unsigned int i = self->n_digits; i-- > 0; max /= 10)
+        digits[i] = max % 10;
+
+    // the passwords below the prefix of max, and then max itself
+    guint64 count = 0;
+    unsigned int last = 0, run = 0;
+    bool ok = false;
+    for (unsigned int i = 0; i < self->n_digits; i++) {
+        for (unsigned int d = run > 0 ? last : 0; d < digits[i]; d++) {
+            unsigned int next_run = run;
+            bool next_ok = ok;
+            push_digit(self, last, d, &next_run, &next_ok);
+            count += completions(self, self->n_digits - i - 1, d, next_run, next_ok);
+        }
+        if (run > 0 && digits[i] < last)
+            return count;
+        push_digit(self, last, digits[i], &run, &ok);
+        last = digits[i];
     }
+    return count + (ok || run_ok(self, run));
+}
 
-    for (size_t i = 0; i < 5;) {
-        size_t j = i + 1;
-        while (j < 6 && digits[i] == digits[j])
+/* Count the valid passwords in [min, max] */
+static guint64
+pwd_counter_count(PwdCounter *self, guint64 min, guint64 max) {
+    if (min > max)
+        return 0;
+    guint64 count = pwd_counter_count_le(self, max);
+    return min > 0 ? count - pwd_counter_count_le(self, min - 1) : count;
+}
+
+/*
+ * A validity rule for the enumeration: it's checked for every password with
+ * non decreasing digits. New rules only need an entry in the rules table.
+ */
+typedef bool pwd_rule_fn(const uint8_t *digits, unsigned int n_digits, unsigned int k);
+
+static bool
+rule_run_at_least(const uint8_t *digits, unsigned int n_digits, unsigned int k) {
+    for (unsigned int i = 0; i < n_digits;) {
+        unsigned int j = i + 1;
+        while (j < n_digits && digits[i] == digits[j])
             j++;
-        if (j - i == 2)
+        if (j - i >= k)
             return true;
         i = j;
     }
+    return false;
+}
 
+static bool
+rule_run_exactly(const uint8_t *digits, unsigned int n_digits, unsigned int k) {
+    for (unsigned int i = 0; i < n_digits;) {
+        unsigned int j = i + 1;
+        while (j < n_digits && digits[i] == digits[j])
+            j++;
+        if (j - i == k)
+            return true;
+        i = j;
+    }
     return false;
 }
 
+static const struct {
+    const char *name;
+    pwd_rule_fn *check;
+} rules[] = {
+    {"part1", rule_run_at_least},
+    {"part2", rule_run_exactly},
+};
+
+/* A sub-range of the passwords, and its output */
+typedef struct {
+    guint64 min;
+    guint64 max;
+    GString *out;
+    bool done;
+} EnumJob;
+
+/*
+ * The enumeration of a range, split in jobs for a pool of threads. The output
+ * of the jobs is written in order, and the threads don't run more than
+ * JOBS_AHEAD jobs per thread ahead of the writer, to bound the memory.
+ */
+typedef struct {
+    pwd_rule_fn *rule;
+    unsigned int k;
+    unsigned int n_digits;
+    EnumJob *jobs;
+    guint n_jobs;
+    guint next_job;
+    guint written;
+    guint max_ahead;
+    GMutex lock;
+    GCond cond;
+} PwdEnum;
+
+/* Digits of val, or of the smallest number with non decreasing digits above it */
+static void
+first_pwd(guint64 val, uint8_t *digits, unsigned int n_digits) {
+    for (unsigned int i = n_digits; i-- > 0; val /= 10)
+        digits[i] = val % 10;
+    for (unsigned int i = 1; i < n_digits; i++)
+        digits[i] = MAX(digits[i], digits[i - 1]);
+}
+
+/* Advance to the next number with non decreasing digits, false after the last one */
 static bool
-next_pwd(uint8_t digits[6]) {
-    static uint8_t max[6] = PASSWORD_MAX;
-
-    // increase 1
-    for (size_t i = 5; i >= 0; i--) {
-        digits[i] += 1;
-        if (digits[i] > 9)
-            digits[i] = 0;
-        else
+next_pwd(uint8_t *digits, unsigned int n_digits) {
+    unsigned int i = n_digits;
+    while (i > 0 && digits[i - 1] == 9)
+        i--;
+    if (i == 0)
+        return false;
+
+    uint8_t d = digits[i - 1] + 1;
+    for (i--; i < n_digits; i++)
+        digits[i] = d;
+    return true;
+}
+
+static void
+enum_job_run(const PwdEnum *self, EnumJob *job) {
+    uint8_t digits[MAX_DIGITS];
+    first_pwd(job->min, digits, self->n_digits);
+
+    job->out = g_string_new(NULL);
+    do {
+        guint64 val = 0;
+        for (unsigned int i = 0; i < self->n_digits; i++)
+            val = val * 10 + digits[i];
+        if (val > job->max)
             break;
+
+        if (self->rule(digits, self->n_digits, self->k)) {
+            for (unsigned int i = 0; i < self->n_digits; i++)
+                g_string_append_c(job->out, '0' + digits[i]);
+            g_string_append_c(job->out, '\n');
+        }
+    } while (next_pwd(digits, self->n_digits));
+}
+
+static gpointer
+enum_worker_run(gpointer data) {
+    PwdEnum *self = data;
+
+    g_mutex_lock(&self->lock);
+    for (;;) {
+        while (self->next_job < self->n_jobs && self->next_job >= self->written + self->max_ahead)
+            g_cond_wait(&self->cond, &self->lock);
+        if (self->next_job >= self->n_jobs)
+            break;
+        EnumJob *job = &self->jobs[self->next_job++];
+
+        g_mutex_unlock(&self->lock);
+        enum_job_run(self, job);
+        g_mutex_lock(&self->lock);
+
+        job->done = true;
+        g_cond_broadcast(&self->cond);
     }
+    g_mutex_unlock(&self->lock);
+    return NULL;
+}
+
+/*
+ * Split [min, max] in ranges that share all the digits but the last ones,
+ * skipping the prefixes with decreasing digits, that have no passwords
+ */
+static GArray *
+split_range(guint64 min, guint64 max, unsigned int n_digits) {
+    guint64 block = 1;
+    while (max / block - min / block + 1 > MAX_JOBS)
+        block *= 10;
 
-    // advance to next number with non decreasing digits
-    for (size_t i = 0; i < 5; i++) {
-        if (digits[i] > digits[i + 1])
-            digits[i + 1] = digits[i];
+    GArray *jobs = g_array_new(FALSE, TRUE, sizeof(EnumJob));
+    for (guint64 prefix = min / block; prefix <= max / block; prefix++) {
+        EnumJob job = {
+            .min = MAX(min, prefix * block),
+            .max = MIN(max, prefix * block + block - 1),
+        };
+
+        uint8_t digits[MAX_DIGITS];
+        first_pwd(job.min, digits, n_digits);
+        guint64 first = 0;
+        for (unsigned int i = 0; i < n_digits; i++)
+            first = first * 10 + digits[i];
+        if (first <= job.max)
+            g_array_append_val(jobs, job);
     }
+    return jobs;
+}
 
-    // check if digits <= max
-    for (size_t i = 0; i < 6; i++) {
-        if (digits[i] > max[i])
-            return false;
-        else if (digits[i] < max[i])
-            return true;
+/* Write to out the valid passwords in [min, max], in order, using n_threads threads */
+static void
+pwd_enumerate(pwd_rule_fn *rule, unsigned int k, unsigned int n_digits, guint64 min, guint64 max,
+              guint n_threads, FILE *out) {
+    GArray *jobs = split_range(min, max, n_digits);
+    PwdEnum self = {
+        .rule = rule,
+        .k = k,
+        .n_digits = n_digits,
+        .jobs = (EnumJob *)jobs->data,
+        .n_jobs = jobs->len,
+        .max_ahead = JOBS_AHEAD * n_threads,
+    };
+    g_mutex_init(&self.lock);
+    g_cond_init(&self.cond);
+
+    GThread **threads = g_new(GThread *, n_threads);
+    for (guint i = 0; i < n_threads; i++)
+        threads[i] = g_thread_new("passwords", enum_worker_run, &self);
+
+    for (guint i = 0; i < self.n_jobs; i++) {
+        EnumJob *job = &self.jobs[i];
+        g_mutex_lock(&self.lock);
+        while (!job->done)
+            g_cond_wait(&self.cond, &self.lock);
+        g_mutex_unlock(&self.lock);
+
+        fwrite(job->out->str, 1, job->out->len, out);
+        g_string_free(job->out, TRUE);
+
+        g_mutex_lock(&self.lock);
+        self.written = i + 1;
+        g_cond_broadcast(&self.cond);
+        g_mutex_unlock(&self.lock);
     }
-    return true;
+
+    for (guint i = 0; i < n_threads; i++)
+        g_thread_join(threads[i]);
+    g_free(threads);
+    g_mutex_clear(&self.lock);
+    g_cond_clear(&self.cond);
+    g_array_free(jobs, TRUE);
+}
+
+static gchar *opt_min = NULL;
+static gchar *opt_max = NULL;
+static gint opt_digits = 0;
+static gint opt_run = 2;
+static gchar *opt_list = NULL;
+static gint opt_threads = 0;
+
+static GOptionEntry options[] = {
+    {"min", 0, 0, G_OPTION_ARG_STRING, &opt_min, "Lower bound of the range (default: " PASSWORD_MIN ")", "N"},
+    {"max", 0, 0, G_OPTION_ARG_STRING, &opt_max, "Upper bound of the range (default: " PASSWORD_MAX ")", "N"},
+    {"digits", 'd', 0, G_OPTION_ARG_INT, &opt_digits, "Digits of the passwords (default: the digits of max)", "N"},
+    {"run", 'k', 0, G_OPTION_ARG_INT, &opt_run, "Length of the run of equal digits: k or more for part 1, exactly k for part 2 (default: 2)", "K"},
+    {"list", 'l', 0, G_OPTION_ARG_STRING, &opt_list, "List the valid passwords for a rule, instead of counting them", "part1|part2"},
+    {"threads", 't', 0, G_OPTION_ARG_INT, &opt_threads, "Number of worker threads for --list (default: number of CPUs)", "N"},
+    {NULL}
+};
+
+static guint64
+parse_bound(const char *str) {
+    char *end;
+    guint64 val = g_ascii_strtoull(str, &end, 10);
+    if (end == str || *end != '\0' || strlen(str) > MAX_DIGITS)
+        aoc_die("Invalid bound, it must have %d digits at most: %s\n", MAX_DIGITS, str);
+    return val;
+}
+
+int
+main(int argc, char **argv) {
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- Secure Container");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+        aoc_die("Option parsing failed: %s\n", error->message);
+    g_option_context_free(context);
+
+    const char *max_str = opt_max != NULL ? opt_max : PASSWORD_MAX;
+    guint64 min = parse_bound(opt_min != NULL ? opt_min : PASSWORD_MIN);
+    guint64 max = parse_bound(max_str);
+    unsigned int n_digits = opt_digits > 0 ? (unsigned int)opt_digits : strlen(max_str);
+    if (n_digits > MAX_DIGITS)
+        aoc_die("The passwords can have %d digits at most\n", MAX_DIGITS);
+    if (opt_run < 1 || opt_run > (gint)n_digits)
+        aoc_die("Invalid run length: %d\n", opt_run);
+
+    // bounds beyond the digits of the passwords
+    guint64 limit = 1;
+    for (unsigned int i = 0; i < n_digits; i++)
+        limit *= 10;
+    max = MIN(max, limit - 1);
+
+    if (opt_list != NULL) {
+        pwd_rule_fn *rule = NULL;
+        for (size_t i = 0; i < G_N_ELEMENTS(rules); i++) {
+            if (!strcmp(rules[i].name, opt_list))
+                rule = rules[i].check;
+        }
+        if (rule == NULL)
+            aoc_die("Unknown rule: %s\n", opt_list);
+
+        guint n_threads = opt_threads > 0 ? (guint)opt_threads : g_get_num_processors();
+        if (min <= max)
+            pwd_enumerate(rule, opt_run, n_digits, min, max, n_threads, stdout);
+        return EXIT_SUCCESS;
+    }
+
+    PwdCounter counter;
+    pwd_counter_init(&counter, RUN_AT_LEAST, opt_run, n_digits);
+    printf("Part 1: number of valid passwords = %" G_GUINT64_FORMAT "\n", pwd_counter_count(&counter, min, max));
+
+    pwd_counter_init(&counter, RUN_EXACTLY, opt_run, n_digits);
+    printf("Part 2: number of valid passwords = %" G_GUINT64_FORMAT "\n", pwd_counter_count(&counter, min, max));
+
+    return EXIT_SUCCESS;
 }
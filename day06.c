@@ -1,5 +1,5 @@
 #include "aoc_input.h"
-#include <assert.h>
+#include "aoc_error.h"
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -7,103 +7,319 @@
 #include <glib.h>
 #include <string.h>
 
-#define NOT_FOUND ((size_t)-1)
+#define NO_BODY UINT32_MAX
+#define DEPTH_UNKNOWN UINT32_MAX
+#define DEPTH_VISITING (UINT32_MAX - 1)
 
-static size_t path_length(GArray *path, const char *planet);
+/*
+ * The bodies are interned to dense ids, in order of appearance, and the tree
+ * is kept in flat arrays indexed by id
+ */
+typedef struct {
+    GHashTable *ids;        // name -> id + 1
+    GStringChunk *names;    // storage of the names
+    GPtrArray *names_by_id;
+    GArray *parents;        // guint32, NO_BODY for the roots
+    GArray *depths;         // guint32, orbits of each body, see compute_depths
+} OrbitMap;
 
-static GHashTable *
+static OrbitMap *
+orbit_map_new() {
+    OrbitMap *self = g_new(OrbitMap, 1);
+    self->ids = g_hash_table_new(g_str_hash, g_str_equal);
+    self->names = g_string_chunk_new(64 * 1024);
+    self->names_by_id = g_ptr_array_new();
+    self->parents = g_array_new(FALSE, FALSE, sizeof(guint32));
+    self->depths = g_array_new(FALSE, FALSE, sizeof(guint32));
+    return self;
+}
+
+static void
+orbit_map_free(OrbitMap *self) {
+    g_hash_table_destroy(self->ids);
+    g_string_chunk_free(self->names);
+    g_ptr_array_free(self->names_by_id, TRUE);
+    g_array_free(self->parents, TRUE);
+    g_array_free(self->depths, TRUE);
+    g_free(self);
+}
+
+static guint32
+orbit_map_lookup(const OrbitMap *self, const char *name) {
+    gpointer id = g_hash_table_lookup(self->ids, name);
+    return id != NULL ? GPOINTER_TO_UINT(id) - 1 : NO_BODY;
+}
+
+/* Return the id of the body, adding it if it's new */
+static guint32
+orbit_map_intern(OrbitMap *self, const char *name) {
+    guint32 id = orbit_map_lookup(self, name);
+    if (id != NO_BODY)
+        return id;
+
+    if (self->parents->len >= NO_BODY - 1)
+        aoc_die("Too many bodies\n");
+    id = self->parents->len;
+    char *key = g_string_chunk_insert(self->names, name);
+    g_hash_table_insert(self->ids, key, GUINT_TO_POINTER(id + 1));
+    g_ptr_array_add(self->names_by_id, key);
+
+    guint32 no_parent = NO_BODY;
+    g_array_append_val(self->parents, no_parent);
+    return id;
+}
+
+#define PARENT(map, id) g_array_index((map)->parents, guint32, id)
+#define DEPTH(map, id) g_array_index((map)->depths, guint32, id)
+
+/*
+ * Fill the depths of all the bodies in O(N): walk up from each body only until
+ * a body with known depth, then assign the depths on the way back. Return
+ * false if there is a cycle.
+ */
+static bool
+orbit_map_compute_depths(OrbitMap *self) {
+    guint32 n = self->parents->len;
+    g_array_set_size(self->depths, n);
+    for (guint32 id = 0; id < n; id++)
+        DEPTH(self, id) = DEPTH_UNKNOWN;
+
+    GArray *stack = g_array_new(FALSE, FALSE, sizeof(guint32));
+    bool ok = true;
+    for (guint32 id = 0; id < n && ok; id++) {
+        guint32 body = id;
+        while (body != NO_BODY && DEPTH(self, body) == DEPTH_UNKNOWN) {
+            DEPTH(self, body) = DEPTH_VISITING;
+            g_array_append_val(stack, body);
+            body = PARENT(self, body);
+        }
+        if (body != NO_BODY && DEPTH(self, body) == DEPTH_VISITING) {
+            fprintf(stderr, "Orbits cycle found at %s\n", (char *)g_ptr_array_index(self->names_by_id, body));
+            ok = false;
+            break;
+        }
+
+        guint32 depth = body != NO_BODY ? DEPTH(self, body) + 1 : 0;
+        while (stack->len > 0) {
+            DEPTH(self, g_array_index(stack, guint32, stack->len - 1)) = depth++;
+            g_array_set_size(stack, stack->len - 1);
+        }
+    }
+
+    g_array_free(stack, TRUE);
+    return ok;
+}
+
+static OrbitMap *
 parse_input() {
     AocInputReader *reader = aoc_input_reader_new("day06");
     if (reader == NULL)
         return NULL;
 
-    GHashTable *orbits = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-    if (orbits == NULL)
-        goto out;
-
+    OrbitMap *map = orbit_map_new();
     char *line;
-    GArray *tokens = NULL;
     while ((line = aoc_input_reader_getline(reader)) != NULL) {
-        tokens = aoc_input_split_char(line, ")", tokens);
-        assert(tokens->len == 2);
+        if (*line == '\0')
+            continue;
+        char *sep = strchr(line, ')');
+        if (sep == NULL)
+            aoc_die("Invalid orbit: %s\n", line);
+        *sep = '\0';
 
-        g_hash_table_insert(orbits,
-                            strdup(g_array_index(tokens, char *, 1)),
-                            strdup(g_array_index(tokens, char *, 0)));
-        g_array_remove_range(tokens, 0, tokens->len);
+        guint32 center = orbit_map_intern(map, line);
+        guint32 body = orbit_map_intern(map, sep + 1);
+        if (PARENT(map, body) != NO_BODY && PARENT(map, body) != center)
+            aoc_die("%s orbits around two bodies\n", sep + 1);
+        PARENT(map, body) = center;
     }
-
-    g_array_free(tokens, TRUE);
-out:
     g_object_unref(reader);
 
-    return orbits;
+    if (!orbit_map_compute_depths(map)) {
+        orbit_map_free(map);
+        return NULL;
+    }
+    return map;
 }
 
-static unsigned int
-part1(GHashTable *orbits) {
-    unsigned int orbits_count = 0;
+static guint64
+part1(const OrbitMap *map) {
+    guint64 orbits_count = 0;
+    for (guint32 id = 0; id < map->depths->len; id++)
+        orbits_count += DEPTH(map, id);
+    return orbits_count;
+}
 
-    gpointer key;
-    GHashTableIter iter;
-    g_hash_table_iter_init(&iter, orbits);
+/*
+ * Binary lifting table for the lowest common ancestor queries: up[k * n + id]
+ * is the ancestor of id 2^k levels above, or the root of its tree. Levels are
+ * only built up to the depth of the deepest body.
+ */
+typedef struct {
+    guint32 n;
+    guint32 levels;
+    guint32 *up;
+    const OrbitMap *map;
+} LcaIndex;
 
-    while (g_hash_table_iter_next(&iter, &key, NULL)) {
-        while (strcmp((char *)key, "COM")) {
-            orbits_count++;
-            key = g_hash_table_lookup(orbits, key);
-        }
-    }
+static LcaIndex *
+lca_index_new(const OrbitMap *map) {
+    LcaIndex *self = g_new(LcaIndex, 1);
+    self->map = map;
+    self->n = map->parents->len;
 
-    return orbits_count;
+    guint32 max_depth = 0;
+    for (guint32 id = 0; id < self->n; id++)
+        max_depth = MAX(max_depth, DEPTH(map, id));
+    self->levels = 1;
+    while (self->levels < 32 && (1u << self->levels) <= max_depth)
+        self->levels++;
+
+    self->up = g_new(guint32, (gsize)self->levels * self->n);
+    for (guint32 id = 0; id < self->n; id++)
+        self->up[id] = PARENT(map, id) != NO_BODY ? PARENT(map, id) : id;
+    for (guint32 k = 1; k < self->levels; k++) {
+        const guint32 *prev = self->up + (gsize)(k - 1) * self->n;
+        guint32 *cur = self->up + (gsize)k * self->n;
+        for (guint32 id = 0; id < self->n; id++)
+            cur[id] = prev[prev[id]];
+    }
+    return self;
 }
 
+static void
+lca_index_free(LcaIndex *self) {
+    g_free(self->up);
+    g_free(self);
+}
 
-static unsigned int
-part2(GHashTable *orbits) {
-    const char *orig  = g_hash_table_lookup(orbits, "YOU");
-    const char *dest = g_hash_table_lookup(orbits, "SAN");
+/* Return the lowest common ancestor of a and b, NO_BODY if they are in different trees */
+static guint32
+lca_index_query(const LcaIndex *self, guint32 a, guint32 b) {
+    const OrbitMap *map = self->map;
+    if (DEPTH(map, a) < DEPTH(map, b)) {
+        guint32 tmp = a;
+        a = b;
+        b = tmp;
+    }
 
-    const char *ship = orig;
-    GArray *path1 = g_array_new(FALSE, FALSE, sizeof(char *));
-    while (strcmp(ship, "COM")) {
-        ship = g_hash_table_lookup(orbits, ship);
-        g_array_append_val(path1, ship);
+    guint32 diff = DEPTH(map, a) - DEPTH(map, b);
+    for (guint32 k = 0; diff != 0; k++, diff >>= 1) {
+        if (diff & 1)
+            a = self->up[(gsize)k * self->n + a];
     }
+    if (a == b)
+        return a;
 
-    ship = dest;
-    size_t path1_len;
-    size_t path2_len = 0;
-    while ((path1_len = path_length(path1, ship)) == NOT_FOUND) {
-        path2_len++;
-        ship = g_hash_table_lookup(orbits, ship);
+    // jump while the ancestors are different, up to the children of the LCA
+    for (guint32 k = self->levels; k-- > 0;) {
+        const guint32 *up = self->up + (gsize)k * self->n;
+        if (up[a] != up[b]) {
+            a = up[a];
+            b = up[b];
+        }
     }
+    // different roots, if they are in different trees
+    return self->up[a] == self->up[b] ? self->up[a] : NO_BODY;
+}
+
+/* Orbital transfers from a to b, NO_BODY if they are not connected */
+static guint32
+lca_index_distance(const LcaIndex *self, guint32 a, guint32 b) {
+    guint32 lca = lca_index_query(self, a, b);
+    if (lca == NO_BODY)
+        return NO_BODY;
+    return DEPTH(self->map, a) + DEPTH(self->map, b) - 2 * DEPTH(self->map, lca);
+}
+
+static guint32
+part2(const OrbitMap *map, const LcaIndex *lca) {
+    guint32 you = orbit_map_lookup(map, "YOU");
+    guint32 san = orbit_map_lookup(map, "SAN");
+    if (you == NO_BODY || san == NO_BODY)
+        aoc_die("YOU or SAN are not in the map\n");
+    if (DEPTH(map, you) == 0 || DEPTH(map, san) == 0 || you == san)
+        aoc_die("YOU and SAN must orbit around something\n");
 
-    g_array_free(path1, TRUE);
-    return path1_len + path2_len;
+    // between the bodies they orbit
+    guint32 count = lca_index_distance(lca, PARENT(map, you), PARENT(map, san));
+    if (count == NO_BODY)
+        aoc_die("There is no path from YOU to SAN\n");
+    return count;
 }
 
-static size_t
-path_length(GArray *path, const char *planet) {
-    for (size_t i = 0; i < path->len; i++) {
-        if (!strcmp(planet, g_array_index(path, char *, i)))
-            return i + 1;
+/*
+ * Answer the queries of the file, a pair of bodies "A B" per line: print the
+ * orbital transfers from A to B, or -1 if there is no path
+ */
+static bool
+answer_queries(const OrbitMap *map, const LcaIndex *lca, const char *path) {
+    AocInputReader *reader = aoc_input_reader_new_path(path);
+    if (reader == NULL)
+        return false;
+
+    char *line;
+    while ((line = aoc_input_reader_getline(reader)) != NULL) {
+        char *a = line + strspn(line, " \t");
+        if (*a == '\0')
+            continue;
+        char *b = a + strcspn(a, " \t");
+        if (*b != '\0')
+            *b++ = '\0';
+        b += strspn(b, " \t");
+        b[strcspn(b, " \t\r")] = '\0';
+
+        guint32 id_a = orbit_map_lookup(map, a), id_b = orbit_map_lookup(map, b);
+        if (id_a == NO_BODY || id_b == NO_BODY) {
+            fprintf(stderr, "Unknown body in query: %s %s\n", a, b);
+            g_object_unref(reader);
+            return false;
+        }
+
+        guint32 count = lca_index_distance(lca, id_a, id_b);
+        if (count == NO_BODY)
+            puts("-1");
+        else
+            printf("%u\n", count);
     }
-    return NOT_FOUND;
+
+    g_object_unref(reader);
+    return true;
 }
 
+static gchar *opt_queries = NULL;
+
+static GOptionEntry options[] = {
+    {"queries", 'q', 0, G_OPTION_ARG_FILENAME, &opt_queries, "Answer the transfers between the pairs of bodies of FILE, one \"A B\" per line", "FILE"},
+    {NULL}
+};
+
 int
 main(int argc, char **argv) {
-    GHashTable *orbits = parse_input();
-    if (orbits == NULL)
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- Universal Orbit Map");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+        aoc_die("Option parsing failed: %s\n", error->message);
+    g_option_context_free(context);
+
+    OrbitMap *map = parse_input();
+    if (map == NULL)
         return EXIT_FAILURE;
+    LcaIndex *lca = lca_index_new(map);
 
-    unsigned int orbits_count = part1(orbits);
-    printf("Part 1: orbits count = %u\n", orbits_count);
+    int rc = EXIT_SUCCESS;
+    if (opt_queries != NULL) {
+        if (!answer_queries(map, lca, opt_queries))
+            rc = EXIT_FAILURE;
+    } else {
+        guint64 orbits_count = part1(map);
+        printf("Part 1: orbits count = %" G_GUINT64_FORMAT "\n", orbits_count);
 
-    orbits_count = part2(orbits);
-    printf("Part 2: orbits count = %u\n", orbits_count);
+        orbits_count = part2(map, lca);
+        printf("Part 2: orbits count = %" G_GUINT64_FORMAT "\n", orbits_count);
+    }
 
-    g_hash_table_destroy(orbits);
-    return EXIT_SUCCESS;
+    lca_index_free(lca);
+    orbit_map_free(map);
+    return rc;
 }
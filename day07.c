@@ -1,289 +1,254 @@
 #include "aoc_input.h"
+#include "aoc_error.h"
+#include "intcode.h"
 #include <glib.h>
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
-typedef enum {
-    OP_ADD = 1,
-    OP_MUL = 2,
-    OP_READ = 3,
-    OP_WRITE = 4,
-    OP_JUMP_TRUE = 5,
-    OP_JUMP_FALSE = 6,
-    OP_LESS = 7,
-    OP_EQUAL = 8,
-    OP_HALT = 99
-} ProgOp;
-
-typedef enum {
-    STATE_HALT,
-    STATE_WAIT_INPUT,
-    STATE_PROG_ERROR = -1
-} ComputerState;
+#define MAX_AMPS 20 // 20! still fits in 64 bits
 
-typedef struct {
-    long *prog;
-    long ip;
-    GQueue *input;
-    GQueue *output;
-    bool halted;
-} Computer;
-
-typedef enum {
-    ARG_MODE_POS = 0,
-    ARG_MODE_IMM = 1
-} ArgMode;
+typedef long solve_fn(Intcode *amps, size_t n_amps, const long *phases);
 
 typedef struct {
-    size_t pos;
-    ArgMode mode;
-} ProgArg;
+    const IntcodeSnapshot *snap;
+    const long *phases; // sorted, the first permutation in lexicographic order
+    size_t n_amps;
+    solve_fn *solve;
+    guint64 n_perms;
+    guint64 chunk;
+    atomic_uint_least64_t next_perm;
+} PermSearch;
 
-typedef long solve_fn(const GArray *prog, long inputs[5]);
+typedef struct {
+    PermSearch *search;
+    GThread *thread;
+    long max_result;
+} Worker;
+
+static gint opt_threads = 0;
+static gchar *opt_phases1 = NULL;
+static gchar *opt_phases2 = NULL;
+static gchar *opt_sched = NULL;
+static IntcodeSched amps_sched = INTCODE_SCHED_COOPERATIVE;
+
+static GOptionEntry options[] = {
+    {"threads", 't', 0, G_OPTION_ARG_INT, &opt_threads, "Number of worker threads (default: number of CPUs)", "N"},
+    {"phases1", 0, 0, G_OPTION_ARG_STRING, &opt_phases1, "Phase settings for part 1 (default: 0,1,2,3,4)", "P,P,..."},
+    {"phases2", 0, 0, G_OPTION_ARG_STRING, &opt_phases2, "Phase settings for part 2 (default: 5,6,7,8,9)", "P,P,..."},
+    {"sched", 's', 0, G_OPTION_ARG_STRING, &opt_sched, "Part 2 feedback loop scheduling: cooperative (default) or threaded", "MODE"},
+    {NULL}
+};
+
+static guint64
+factorial(size_t n) {
+    guint64 result = 1;
+    for (size_t i = 2; i <= n; i++)
+        result *= i;
+    return result;
+}
 
-static void computer_init(Computer *self, const GArray *prog);
-static void computer_deinit(Computer *self);
-static ComputerState computer_run(Computer *self);
-static long prog_get(long *prog, ProgArg arg);
-static void prog_set(long *prog, ProgArg arg, long val);
-static void swap(long *a, long *b);
+/* Write in perm the k-th permutation, in lexicographic order, of sorted */
+static void
+perm_unrank(const long *sorted, size_t n, guint64 k, long *perm) {
+    long pool[MAX_AMPS];
+    memcpy(pool, sorted, n * sizeof(long));
 
-#define queue_pop(queue) ((long)g_queue_pop_head(queue))
-#define queue_push(queue, long_val) (g_queue_push_tail((queue), (gpointer)long_val))
+    for (size_t i = 0; i < n; i++) {
+        guint64 f = factorial(n - 1 - i);
+        size_t idx = k / f;
+        k %= f;
 
-static void
-run_with_permutations(long inputs[5], size_t i,
-                      solve_fn solve, const GArray *prog, long *max_result) {
-    if (i == 5) {
-        long result = solve(prog, inputs);
-        if (result > *max_result)
-            *max_result = result;
-
-        return;
+        perm[i] = pool[idx];
+        memmove(pool + idx, pool + idx + 1, (n - 1 - i - idx) * sizeof(long));
     }
+}
 
-    for (size_t j = i; j < 5; j++) {
-        swap(inputs + i, inputs + j);
-        run_with_permutations(inputs, i + 1, solve, prog, max_result);
-        swap(inputs + i, inputs + j);
+/* Advance perm to the next permutation in lexicographic order */
+static bool
+perm_next(long *perm, size_t n) {
+    if (n < 2)
+        return false;
+
+    size_t i = n - 1;
+    while (i > 0 && perm[i - 1] >= perm[i])
+        i--;
+    if (i == 0)
+        return false;
+
+    size_t j = n - 1;
+    while (perm[j] <= perm[i - 1])
+        j--;
+
+    long tmp = perm[i - 1];
+    perm[i - 1] = perm[j];
+    perm[j] = tmp;
+
+    for (size_t a = i, b = n - 1; a < b; a++, b--) {
+        tmp = perm[a];
+        perm[a] = perm[b];
+        perm[b] = tmp;
     }
+    return true;
 }
 
-static long
-solve_part1(const GArray *prog, long inputs[5]) {
-    long val = 0;
-    Computer computer;
-
-    for (size_t i = 0; i < 5; i++) {
-        computer_init(&computer, prog);
+static gpointer
+worker_run(gpointer data) {
+    Worker *self = data;
+    PermSearch *search = self->search;
 
-        queue_push(computer.input, inputs[i]);
-        queue_push(computer.input, val);
-        ComputerState rc = computer_run(&computer);
-        if (rc == STATE_PROG_ERROR)
-            return LONG_MIN;
-        val = queue_pop(computer.output);
+    Intcode amps[MAX_AMPS];
+    for (size_t i = 0; i < search->n_amps; i++)
+        intcode_fork(&amps[i], search->snap);
 
-        computer_deinit(&computer);
+    long perm[MAX_AMPS];
+    while (true) {
+        guint64 start = atomic_fetch_add(&search->next_perm, search->chunk);
+        if (start >= search->n_perms)
+            break;
+        guint64 end = MIN(start + search->chunk, search->n_perms);
+
+        perm_unrank(search->phases, search->n_amps, start, perm);
+        for (guint64 k = start; k < end; k++) {
+            long result = search->solve(amps, search->n_amps, perm);
+            if (result > self->max_result)
+                self->max_result = result;
+            perm_next(perm, search->n_amps);
+        }
     }
 
-    return val;
+    for (size_t i = 0; i < search->n_amps; i++)
+        intcode_deinit(&amps[i]);
+    return NULL;
 }
 
 static long
-solve_part2(const GArray *prog, long inputs[5]) {
-    Computer computers[5];
-    for (size_t i = 0; i < 5; i++) {
-        computer_init(&computers[i], prog);
-        queue_push(computers[i].input, inputs[i]);
+run_with_permutations(const GArray *prog, GArray *phases, solve_fn solve, guint n_threads) {
+    // all the amplifiers run the same code until they read the phase setting:
+    // run it once, and start every amplifier from that point
+    Intcode base;
+    intcode_init(&base, prog);
+    if (intcode_run(&base) != STATE_WAIT_INPUT)
+        intcode_reset(&base);
+    IntcodeSnapshot *snap = intcode_snapshot_new(&base);
+    intcode_deinit(&base);
+
+    PermSearch search = {
+        .snap = snap,
+        .phases = (long *)phases->data,
+        .n_amps = phases->len,
+        .solve = solve,
+        .n_perms = factorial(phases->len),
+    };
+    search.chunk = MAX(search.n_perms / (n_threads * 64), 1);
+    atomic_init(&search.next_perm, 0);
+
+    Worker *workers = g_new0(Worker, n_threads);
+    for (guint i = 0; i < n_threads; i++) {
+        workers[i].search = &search;
+        workers[i].max_result = LONG_MIN;
+        workers[i].thread = g_thread_new("amplifiers", worker_run, &workers[i]);
     }
 
-    long val;
-    GQueue io_pipe = G_QUEUE_INIT;
-    queue_push(&io_pipe, 0);
-
-    while (true) {
-        for (size_t i = 0; i < 5; i++) {
-            if (computers[i].halted)
-                return LONG_MIN;
+    long max_result = LONG_MIN;
+    for (guint i = 0; i < n_threads; i++) {
+        g_thread_join(workers[i].thread);
+        if (workers[i].max_result > max_result)
+            max_result = workers[i].max_result;
+    }
 
-            while (!g_queue_is_empty(&io_pipe))
-                queue_push(computers[i].input, queue_pop(&io_pipe));
+    g_free(workers);
+    intcode_snapshot_free(snap);
+    return max_result;
+}
 
-            ComputerState rc = computer_run(&computers[i]);
-            if (rc == STATE_PROG_ERROR)
-                return LONG_MIN;
+static long
+solve_part1(Intcode *amps, size_t n_amps, const long *phases) {
+    long val = 0;
 
-            while (!g_queue_is_empty(computers[i].output))
-                queue_push(&io_pipe, queue_pop(computers[i].output));
+    for (size_t i = 0; i < n_amps; i++) {
+        Intcode *computer = &amps[i];
+        intcode_reset(computer);
 
-            if (i == 4 && rc == STATE_HALT) {
-                val = io_pipe.length == 1 ? queue_pop(&io_pipe) : LONG_MIN;
-                goto out;
-            }
-        }
+        intcode_input_push(computer, phases[i]);
+        intcode_input_push(computer, val);
+        IntcodeState rc = intcode_run(computer);
+        if (rc == STATE_PROG_ERROR || !intcode_output_pop(computer, &val))
+            return LONG_MIN;
     }
-out:
-    for (size_t i = 0; i < 5; i++)
-        computer_deinit(&computers[i]);
-    g_queue_clear(&io_pipe);
+
     return val;
 }
 
-static ComputerState
-computer_run(Computer *self) {
-    while (true) {
-        long op_and_mode = self->prog[self->ip];
-        ProgOp op = op_and_mode % 100;
-
-        ArgMode mode1 = (op_and_mode / 100) % 10;
-        ProgArg arg1 = {.pos = self->ip + 1, .mode = mode1};
-
-        ArgMode mode2 = (op_and_mode / 1000) % 10;
-        ProgArg arg2 = {.pos = self->ip + 2, .mode = mode2};
-
-        ArgMode mode3 = (op_and_mode / 10000) % 10;
-        ProgArg arg3 = {.pos = self->ip + 3, .mode = mode3};
-
-        long result;
-
-        switch (op) {
-        case OP_ADD:
-            result = prog_get(self->prog, arg1) + prog_get(self->prog, arg2);
-            prog_set(self->prog, arg3, result);
-            self->ip += 4;
-            break;
-
-        case OP_MUL:
-            result = prog_get(self->prog, arg1) * prog_get(self->prog, arg2);
-            prog_set(self->prog, arg3, result);
-            self->ip += 4;
-            break;
-
-        case OP_READ:
-            if (g_queue_is_empty(self->input)) {
-                return STATE_WAIT_INPUT;
-            } else {
-                result = queue_pop(self->input);
-                prog_set(self->prog, arg1, result);
-                self->ip += 2;
-            }
-            break;
-
-        case OP_WRITE:
-            result = prog_get(self->prog, arg1);
-            queue_push(self->output, result);
-            self->ip += 2;
-            break;
-
-        case OP_JUMP_TRUE:
-            if (prog_get(self->prog, arg1) != 0)
-                self->ip = prog_get(self->prog, arg2);
-            else
-                self->ip += 3;
-            break;
-
-        case OP_JUMP_FALSE:
-            if (prog_get(self->prog, arg1) == 0)
-                self->ip = prog_get(self->prog, arg2);
-            else
-                self->ip += 3;
-            break;
-
-        case OP_LESS:
-            result = prog_get(self->prog, arg1) < prog_get(self->prog, arg2);
-            prog_set(self->prog, arg3, result);
-            self->ip += 4;
-            break;
-
-        case OP_EQUAL:
-            result = prog_get(self->prog, arg1) == prog_get(self->prog, arg2);
-            prog_set(self->prog, arg3, result);
-            self->ip += 4;
-            break;
+static long
+solve_part2(Intcode *amps, size_t n_amps, const long *phases) {
+    for (size_t i = 0; i < n_amps; i++) {
+        intcode_reset(&amps[i]);
+        intcode_connect(&amps[i], &amps[(i + 1) % n_amps]);
+        intcode_input_push(&amps[i], phases[i]);
+    }
+    intcode_input_push(&amps[0], 0);
 
-        case OP_HALT:
-            self->halted = true;
-            return STATE_HALT;
+    if (intcode_run_all(amps, n_amps, amps_sched) != STATE_HALT)
+        return LONG_MIN;
 
-        default:
-            return STATE_PROG_ERROR;
-        }
-    }
+    // the last amplifier's output is fed back to the first one
+    long val;
+    if (intcode_chan_len(amps[0].input) != 1 || !intcode_chan_pop(amps[0].input, &val))
+        return LONG_MIN;
+    return val;
 }
 
-static long
-prog_get(long *prog, ProgArg arg) {
-    switch (arg.mode) {
-    case ARG_MODE_POS:
-        return prog[prog[arg.pos]];
-    case ARG_MODE_IMM:
-        return prog[arg.pos];
-    default:
-        fprintf(stderr, "Invalid ArgMode %d\n", arg.mode);
-        exit(EXIT_FAILURE);
-    }
+static gint
+compare_long(gconstpointer a, gconstpointer b) {
+    long la = *(const long *)a, lb = *(const long *)b;
+    return (la > lb) - (la < lb);
 }
 
-static void
-prog_set(long *prog, ProgArg arg, long val) {
-    if (arg.mode != ARG_MODE_POS) {
-        fprintf(stderr, "Invalid arg mode for prog_set (%d)\n", arg.mode);
-        exit(EXIT_FAILURE);
+static GArray *
+parse_phases(const char *str) {
+    char *buff = g_strdup(str);
+    GArray *tokens = aoc_input_split_char(buff, ",", NULL);
+    GArray *phases = g_array_sized_new(FALSE, FALSE, sizeof(long), tokens->len);
+
+    for (size_t i = 0; i < tokens->len; i++) {
+        long val = aoc_input_parse_num(g_array_index(tokens, char *, i));
+        if (val == PARSE_NUM_ERR)
+            aoc_die("Invalid phase settings: %s\n", str);
+        g_array_append_val(phases, val);
     }
-    prog[prog[arg.pos]] = val;
-}
-
-void
-computer_init(Computer *self, const GArray *prog) {
-    long *prog_clone = calloc(prog->len, sizeof(long));
-    memcpy(prog_clone, prog->data, prog->len * sizeof(long));
 
-    self->prog = prog_clone;
-    self->ip = 0;
-    self->input = g_queue_new();
-    self->output = g_queue_new();
-    self->halted = false;
-}
+    if (phases->len == 0 || phases->len > MAX_AMPS)
+        aoc_die("Number of phases must be between 1 and %d: %s\n", MAX_AMPS, str);
 
-static void
-computer_deinit(Computer *self) {
-    g_free(self->prog);
-    g_queue_free(self->input);
-    g_queue_free(self->output);
-}
+    g_array_sort(phases, compare_long);
+    for (size_t i = 1; i < phases->len; i++) {
+        if (g_array_index(phases, long, i) == g_array_index(phases, long, i - 1))
+            aoc_die("Repeated phase setting: %s\n", str);
+    }
 
-static void
-swap(long *a, long *b) {
-    long tmp = *a;
-    *a = *b;
-    *b = tmp;
+    g_array_free(tokens, TRUE);
+    g_free(buff);
+    return phases;
 }
 
 static GArray *
 parse_input() {
-    AocInputReader *reader = aoc_input_reader_new("day07");
+    AocInputReader *reader = aoc_input_reader_new_mapped("day07");
     if (reader == NULL)
         return NULL;
 
-    GArray *values = g_array_new(FALSE, FALSE, sizeof(long));
-    if (values == NULL)
-        goto out;
-
-    char *token;
-    while ((token = aoc_input_reader_getdelim(reader, ',')) != NULL) {
-        long val = aoc_input_parse_num(token);
-        if (val == PARSE_NUM_ERR) {
-            fprintf(stderr, "Parse number error: %s\n", token);
-            exit(EXIT_FAILURE);
-        }
-
-        g_array_append_val(values, val);
+    size_t len, err_offset;
+    const char *data = aoc_input_reader_get_data(reader, &len);
+    GArray *values = aoc_input_parse_num_list(data, len, ',', &err_offset);
+    if (values == NULL) {
+        fprintf(stderr, "Parse number error at offset %zu\n", err_offset);
+        exit(EXIT_FAILURE);
     }
 
-out:
     g_object_unref(reader);
     return values;
 }
@@ -291,22 +256,36 @@ out:
 
 int
 main(int argc, char **argv) {
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("- Amplification Circuit");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+        aoc_die("Option parsing failed: %s\n", error->message);
+    g_option_context_free(context);
+
+    if (opt_sched != NULL && !strcmp(opt_sched, "threaded"))
+        amps_sched = INTCODE_SCHED_THREADED;
+    else if (opt_sched != NULL && strcmp(opt_sched, "cooperative"))
+        aoc_die("Invalid scheduling mode: %s\n", opt_sched);
+
+    guint n_threads = opt_threads > 0 ? (guint)opt_threads : g_get_num_processors();
+    GArray *phases1 = parse_phases(opt_phases1 != NULL ? opt_phases1 : "0,1,2,3,4");
+    GArray *phases2 = parse_phases(opt_phases2 != NULL ? opt_phases2 : "5,6,7,8,9");
+
     GArray *prog = parse_input();
     if (prog == NULL) {
         fprintf(stderr, "Error parsing the input\n");
         return EXIT_FAILURE;
     }
 
-    long max_result = 0;
-    long inputs[] = {0, 1, 2, 3, 4};
-    run_with_permutations(inputs, 0, solve_part1, prog, &max_result);
+    long max_result = run_with_permutations(prog, phases1, solve_part1, n_threads);
     printf("Part 1: max result = %ld\n", max_result);
 
-    max_result = 0;
-    long inputs2[] = {5, 6, 7, 8, 9};
-    run_with_permutations(inputs2, 0, solve_part2, prog, &max_result);
+    max_result = run_with_permutations(prog, phases2, solve_part2, n_threads);
     printf("Part 2: max result = %ld\n", max_result);
 
+    g_array_free(phases1, TRUE);
+    g_array_free(phases2, TRUE);
     g_array_free(prog, TRUE);
     return 0;
 }
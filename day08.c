@@ -1,88 +1,414 @@
 #include "aoc_input.h"
+#include "aoc_error.h"
+#include <glib.h>
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define COLS 25u
-#define ROWS 6u
-#define LAYER_SIZE (COLS * ROWS)
+#define DEFAULT_GEOMETRY "25x6"
+#define MAX_LAYER_SIZE (1u << 24)
 #define BLACK '0'
 #define WHITE '1'
 #define TRANSPARENT '2'
 
-unsigned int
-part1(const char *pixels) {
-    unsigned int min_zeros = UINT_MAX;
-    unsigned int result = 0;
+// the decoder is specialised for the common image sizes, the kernels must be
+// inlined with the constant layer size
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
 
-    size_t pos = 0;
-    unsigned int counts[3] = {0, 0, 0};
+#ifdef __GNUC__
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VEC_WIDTH 32
+typedef __m256i vec;
+#define vec_load(p) _mm256_loadu_si256((const __m256i *)(p))
+#define vec_store(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+#define vec_set1(c) _mm256_set1_epi8(c)
+#define vec_eq(a, b) _mm256_cmpeq_epi8(a, b)
+#define vec_select(m, a, b) _mm256_blendv_epi8(b, a, m)
+#define vec_movemask(v) ((guint32)_mm256_movemask_epi8(v))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VEC_WIDTH 16
+typedef __m128i vec;
+#define vec_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define vec_store(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define vec_set1(c) _mm_set1_epi8(c)
+#define vec_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define vec_select(m, a, b) _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b))
+#define vec_movemask(v) ((guint32)_mm_movemask_epi8(v))
+#endif
+#endif
 
-    for (const char *px = pixels; *px != '\0'; px++) {
-        switch (*px) {
-        case '0': counts[0]++; break;
-        case '1': counts[1]++; break;
-        case '2': counts[2]++; break;
+enum { COUNT_0, COUNT_1, COUNT_2, COUNT_NEWLINE, COUNT_MAX };
+
+static void
+stats_scalar(const char *layer, size_t n, unsigned int counts[COUNT_MAX]) {
+    for (size_t i = 0; i < n; i++) {
+        switch (layer[i]) {
+        case '0': counts[COUNT_0]++; break;
+        case '1': counts[COUNT_1]++; break;
+        case '2': counts[COUNT_2]++; break;
+        case '\n': counts[COUNT_NEWLINE]++; break;
         default: break;
         }
+    }
+}
+
+static unsigned int
+compose_scalar(char *image, const char *layer, size_t n) {
+    unsigned int left = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (image[i] == TRANSPARENT)
+            image[i] = layer[i];
+        left += image[i] == TRANSPARENT;
+    }
+    return left;
+}
+
+#ifdef VEC_WIDTH
+static ALWAYS_INLINE void
+stats_block(const char *p, guint32 mask, unsigned int counts[COUNT_MAX]) {
+    vec block = vec_load(p);
+    counts[COUNT_0] += __builtin_popcount(vec_movemask(vec_eq(block, vec_set1('0'))) & mask);
+    counts[COUNT_1] += __builtin_popcount(vec_movemask(vec_eq(block, vec_set1('1'))) & mask);
+    counts[COUNT_2] += __builtin_popcount(vec_movemask(vec_eq(block, vec_set1('2'))) & mask);
+    counts[COUNT_NEWLINE] += __builtin_popcount(vec_movemask(vec_eq(block, vec_set1('\n'))) & mask);
+}
+
+/* Take the layer pixels where the image is transparent, return how many still are */
+static ALWAYS_INLINE unsigned int
+compose_block(char *image, const char *layer, guint32 mask) {
+    vec transparent = vec_set1(TRANSPARENT);
+    vec px = vec_load(image);
+    px = vec_select(vec_eq(px, transparent), vec_load(layer), px);
+    vec_store(image, px);
+    return __builtin_popcount(vec_movemask(vec_eq(px, transparent)) & mask);
+}
+#endif
+
+/*
+ * Layers are not a multiple of VEC_WIDTH: the last block overlaps the previous
+ * one, and the bytes already seen are masked out. Composing them again is
+ * harmless. Layers smaller than a block are done one pixel at a time.
+ */
+static ALWAYS_INLINE void
+layer_stats(const char *layer, size_t n, unsigned int counts[COUNT_MAX]) {
+    memset(counts, 0, COUNT_MAX * sizeof(counts[0]));
+#ifdef VEC_WIDTH
+    if (n >= VEC_WIDTH) {
+        size_t i;
+        for (i = 0; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+            stats_block(layer + i, ~0u, counts);
+        if (i < n)
+            stats_block(layer + n - VEC_WIDTH, ~0u << (VEC_WIDTH - (n - i)), counts);
+        return;
+    }
+#endif
+    stats_scalar(layer, n, counts);
+}
+
+static ALWAYS_INLINE unsigned int
+layer_compose(char *image, const char *layer, size_t n) {
+#ifdef VEC_WIDTH
+    if (n >= VEC_WIDTH) {
+        unsigned int left = 0;
+        size_t i;
+        for (i = 0; i + VEC_WIDTH <= n; i += VEC_WIDTH)
+            left += compose_block(image + i, layer + i, ~0u);
+        if (i < n)
+            left += compose_block(image + n - VEC_WIDTH, layer + n - VEC_WIDTH, ~0u << (VEC_WIDTH - (n - i)));
+        return left;
+    }
+#endif
+    return compose_scalar(image, layer, n);
+}
+
+typedef struct Decoder Decoder;
+typedef void decoder_feed_fn(Decoder *self, const char *pixels, size_t len);
 
-        if (++pos == LAYER_SIZE) {
-            if (counts[0] < min_zeros) {
-                min_zeros = counts[0];
-                result = counts[1] * counts[2];
+/*
+ * Decoding of the layers, fed with the pixels chunk by chunk: the layers don't
+ * need to be in memory at once
+ */
+struct Decoder {
+    size_t cols;
+    size_t rows;
+    size_t size;                // of a layer, cols * rows
+    decoder_feed_fn *feed;      // specialised for the size, if it's a common one
+    size_t pos;                 // pixels in the partial layer
+    size_t n_layers;
+    unsigned int min_zeros;
+    unsigned long result;       // part 1, for the layer with fewer zeros
+    unsigned int transparent;   // pixels of the image not decoded yet
+    char *layer;                // partial layer, split between chunks
+    char *image;                // part 2, NUL terminated
+};
+
+static ALWAYS_INLINE void
+decoder_add_layer(Decoder *self, const char *layer, const unsigned int counts[COUNT_MAX], size_t size) {
+    if (counts[COUNT_0] < self->min_zeros) {
+        self->min_zeros = counts[COUNT_0];
+        self->result = (unsigned long)counts[COUNT_1] * counts[COUNT_2];
+    }
+    // once the image is complete the rest of layers are hidden
+    if (self->transparent > 0)
+        self->transparent = layer_compose(self->image, layer, size);
+    self->n_layers++;
+}
+
+static ALWAYS_INLINE void
+feed_sized(Decoder *self, const char *pixels, size_t len, size_t size) {
+    const char *px = pixels, *end = pixels + len;
+    unsigned int counts[COUNT_MAX];
+
+    while (px < end) {
+        // whole layers are decoded in place, unless there are line breaks
+        if (self->pos == 0 && (size_t)(end - px) >= size) {
+            layer_stats(px, size, counts);
+            if (counts[COUNT_NEWLINE] == 0) {
+                decoder_add_layer(self, px, counts, size);
+                px += size;
+                continue;
             }
-            pos = 0;
-            counts[0] = counts[1] = counts[2] = 0;
+        }
+
+        for (; px < end && self->pos < size; px++) {
+            if (*px != '\n')
+                self->layer[self->pos++] = *px;
+        }
+        if (self->pos == size) {
+            layer_stats(self->layer, size, counts);
+            decoder_add_layer(self, self->layer, counts, size);
+            self->pos = 0;
         }
     }
+}
 
-    return result;
+#define DECODER_FEED_FIXED(cols, rows)                                            \
+    static void                                                                   \
+    decoder_feed_##cols##x##rows(Decoder *self, const char *pixels, size_t len) { \
+        feed_sized(self, pixels, len, cols * rows);                               \
+    }
+
+DECODER_FEED_FIXED(25, 6)
+
+static void
+decoder_feed_any(Decoder *self, const char *pixels, size_t len) {
+    feed_sized(self, pixels, len, self->size);
 }
 
-char *
-part2(const char *pixels) {
-    char *image = calloc(LAYER_SIZE, sizeof(char));
-    size_t i = 0;
+static const struct {
+    size_t cols;
+    size_t rows;
+    decoder_feed_fn *feed;
+} fixed_sizes[] = {
+    {25, 6, decoder_feed_25x6},
+};
 
-    memset(image, TRANSPARENT, LAYER_SIZE);
+/* cols * rows must be between 1 and MAX_LAYER_SIZE */
+void
+decoder_init(Decoder *self, size_t cols, size_t rows) {
+    self->cols = cols;
+    self->rows = rows;
+    self->size = cols * rows;
+    self->feed = decoder_feed_any;
+    for (size_t i = 0; i < G_N_ELEMENTS(fixed_sizes); i++) {
+        if (fixed_sizes[i].cols == cols && fixed_sizes[i].rows == rows)
+            self->feed = fixed_sizes[i].feed;
+    }
 
-    for (const char *px = pixels; *px != '\0'; px++) {
-        if (*px != TRANSPARENT && image[i] == TRANSPARENT)
-            image[i] = *px;
+    self->pos = 0;
+    self->n_layers = 0;
+    self->min_zeros = UINT_MAX;
+    self->result = 0;
+    self->transparent = self->size;
+    self->layer = g_malloc(self->size);
+    self->image = g_malloc(self->size + 1);
+    memset(self->image, TRANSPARENT, self->size);
+    self->image[self->size] = '\0';
+}
 
-        if (++i == LAYER_SIZE)
-            i = 0;
+void
+decoder_deinit(Decoder *self) {
+    g_free(self->layer);
+    g_free(self->image);
+}
+
+void
+decoder_feed(Decoder *self, const char *pixels, size_t len) {
+    self->feed(self, pixels, len);
+}
+
+/* An image file to decode, and the results */
+typedef struct {
+    const char *path;       // NULL for the day08 input
+    size_t cols;
+    size_t rows;
+    const char *error;      // NULL if it was decoded
+    unsigned long result;
+    char *image;
+} ImageJob;
+
+static void
+decode_image(ImageJob *job) {
+    AocInputReader *reader = job->path != NULL ? aoc_input_reader_new_path(job->path)
+                                               : aoc_input_reader_new("day08");
+    if (reader == NULL) {
+        job->error = "can't open the file";
+        return;
+    }
+
+    Decoder decoder;
+    decoder_init(&decoder, job->cols, job->rows);
+
+    const char *pixels;
+    size_t len;
+    while ((pixels = aoc_input_reader_next_chunk(reader, '\0', &len)) != NULL)
+        decoder_feed(&decoder, pixels, len);
+
+    if (decoder.n_layers == 0 || decoder.pos != 0) {
+        job->error = "the size of the image is not a multiple of a layer";
+    } else {
+        job->result = decoder.result;
+        job->image = decoder.image;
+        decoder.image = NULL;
+    }
+
+    decoder_deinit(&decoder);
+    g_object_unref(reader);
+}
+
+typedef struct {
+    ImageJob *jobs;
+    size_t n_jobs;
+    atomic_size_t next_job;
+} ImageBatch;
+
+static gpointer
+batch_worker_run(gpointer data) {
+    ImageBatch *batch = data;
+    size_t i;
+    while ((i = atomic_fetch_add(&batch->next_job, 1)) < batch->n_jobs)
+        decode_image(&batch->jobs[i]);
+    return NULL;
+}
+
+/* Decode all the images, in n_threads threads */
+void
+decode_images(ImageJob *jobs, size_t n_jobs, guint n_threads) {
+    ImageBatch batch = {.jobs = jobs, .n_jobs = n_jobs};
+    atomic_init(&batch.next_job, 0);
+
+    n_threads = MIN(n_threads, n_jobs);
+    if (n_threads <= 1) {
+        batch_worker_run(&batch);
+        return;
     }
 
-    return image;
+    GThread **threads = g_new(GThread *, n_threads);
+    for (guint i = 0; i < n_threads; i++)
+        threads[i] = g_thread_new("decoder", batch_worker_run, &batch);
+    for (guint i = 0; i < n_threads; i++)
+        g_thread_join(threads[i]);
+    g_free(threads);
 }
 
 void
-print_image(const char *image) {
+print_image(const char *image, size_t cols) {
     size_t i = 0;
 
     for (const char *px = image; *px != '\0'; px++) {
         printf("%c", *px == WHITE ? '#' : ' ');
-        if (++i == COLS) {
+        if (++i == cols) {
             puts("");
             i = 0;
         }
     }
 }
 
+/* Parse "COLSxROWS" */
+static bool
+parse_geometry(const char *str, size_t *cols, size_t *rows) {
+    char *end;
+    guint64 c = g_ascii_strtoull(str, &end, 10);
+    if (end == str || *end != 'x')
+        return false;
+    str = end + 1;
+    guint64 r = g_ascii_strtoull(str, &end, 10);
+    if (end == str || *end != '\0')
+        return false;
+    if (c == 0 || r == 0 || c > MAX_LAYER_SIZE || r > MAX_LAYER_SIZE / c)
+        return false;
+
+    *cols = c;
+    *rows = r;
+    return true;
+}
+
+static gint opt_threads = 0;
+static gchar *opt_size = NULL;
+
+static GOptionEntry options[] = {
+    {"threads", 't', 0, G_OPTION_ARG_INT, &opt_threads, "Number of worker threads (default: number of CPUs)", "N"},
+    {"size", 's', 0, G_OPTION_ARG_STRING, &opt_size, "Size of the images (default: " DEFAULT_GEOMETRY ")", "COLSxROWS"},
+    {NULL}
+};
+
 int
 main(int argc, char **argv) {
-    AocInputReader *reader = aoc_input_reader_new("day08");
-    char *pixels = aoc_input_reader_getline(reader);
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("[FILE[:COLSxROWS]...] - Space Image Format");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+        aoc_die("Option parsing failed: %s\n", error->message);
+    g_option_context_free(context);
 
-    unsigned int result = part1(pixels);
-    printf("Part 1: result = %u\n", result);
+    size_t cols, rows;
+    if (!parse_geometry(opt_size != NULL ? opt_size : DEFAULT_GEOMETRY, &cols, &rows))
+        aoc_die("Invalid image size: %s\n", opt_size);
 
-    char *image = part2(pixels);
-    printf("Part 2: message:\n");
-    print_image(image);
+    // without files, decode the day08 input
+    size_t n_jobs = argc > 1 ? (size_t)argc - 1 : 1;
+    ImageJob *jobs = g_new0(ImageJob, n_jobs);
+    for (size_t i = 0; i < n_jobs; i++) {
+        jobs[i].cols = cols;
+        jobs[i].rows = rows;
+        if (argc == 1)
+            continue;
 
-    g_object_unref(reader);
-    free(image);
-    return 0;
+        // FILE:COLSxROWS overrides the size for that file
+        jobs[i].path = argv[i + 1];
+        char *sep = strrchr(argv[i + 1], ':');
+        if (sep != NULL && parse_geometry(sep + 1, &jobs[i].cols, &jobs[i].rows))
+            *sep = '\0';
+    }
+
+    guint n_threads = opt_threads > 0 ? (guint)opt_threads : g_get_num_processors();
+    decode_images(jobs, n_jobs, n_threads);
+
+    int rc = EXIT_SUCCESS;
+    for (size_t i = 0; i < n_jobs; i++) {
+        if (jobs[i].path != NULL)
+            printf("%s (%zux%zu):\n", jobs[i].path, jobs[i].cols, jobs[i].rows);
+        if (jobs[i].error != NULL) {
+            fprintf(stderr, "Error decoding %s: %s\n", jobs[i].path != NULL ? jobs[i].path : "the input",
+                    jobs[i].error);
+            rc = EXIT_FAILURE;
+            continue;
+        }
+
+        printf("Part 1: result = %lu\n", jobs[i].result);
+        printf("Part 2: message:\n");
+        print_image(jobs[i].image, jobs[i].cols);
+        g_free(jobs[i].image);
+    }
+
+    g_free(jobs);
+    return rc;
 }
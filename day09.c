@@ -1,252 +1,520 @@
 #include "aoc_input.h"
 #include "aoc_error.h"
+#include "intcode.h"
+#include "intcode_aot.h"
 #include <glib.h>
 #include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
-#include <assert.h>
-
-typedef struct {
-    GHashTable *mem;
-    long ip;
-    long rel_base;
-    GQueue *input;
-    GQueue *output;
-    bool halted;
-} Prog;
-
-typedef enum {
-    STATE_HALT,
-    STATE_WAIT_INPUT,
-    STATE_PROG_ERROR = -1
-} ProgState;
-
-typedef enum {
-    ARG_MODE_POS = 0,
-    ARG_MODE_IMM = 1,
-    ARG_MODE_REL = 2
-} ArgMode;
-
-typedef struct {
-    size_t pos;
-    ArgMode mode;
-} Arg;
-
-typedef enum {
-    OP_ADD = 1,
-    OP_MUL = 2,
-    OP_READ = 3,
-    OP_WRITE = 4,
-    OP_JUMP_TRUE = 5,
-    OP_JUMP_FALSE = 6,
-    OP_LESS = 7,
-    OP_EQUAL = 8,
-    OP_MV_BASE = 9,
-    OP_HALT = 99
-} Op;
-
-static void prog_init(Prog *self, const GArray *prog);
-static void prog_deinit(Prog *self);
-static ProgState prog_run(Prog *self);
-static long prog_memget(Prog *self, Arg arg);
-static void prog_memset(Prog *self, Arg arg, long val);
-
-#define queue_pop(queue) ((long)g_queue_pop_head(queue))
-#define queue_push(queue, long_val) (g_queue_push_tail((queue), (gpointer)long_val))
 
 static long
 solve(const GArray *prog_data, long input) {
-    Prog computer;
-    prog_init(&computer, prog_data);
+    Intcode computer;
+    intcode_init(&computer, prog_data);
 
-    queue_push(computer.input, input);
-    ProgState rc = prog_run(&computer);
+    intcode_input_push(&computer, input);
+    IntcodeState rc = intcode_run(&computer);
     if (rc != STATE_HALT)
         aoc_die("Unexpected program exit status (%d)\n", rc);
-    long ret = queue_pop(computer.output);
 
-    prog_deinit(&computer);
+    long ret;
+    if (!intcode_output_pop(&computer, &ret))
+        aoc_die("Program output is empty\n");
+
+    intcode_deinit(&computer);
     return ret;
 }
 
-static ProgState
-prog_run(Prog *self) {
-    while (true) {
-        Arg arg0 = {.pos = self->ip, .mode = ARG_MODE_IMM};
-        long op_and_mode = prog_memget(self, arg0);
-        Op op = op_and_mode % 100;
-
-        ArgMode mode1 = (op_and_mode / 100) % 10;
-        Arg arg1 = {.pos = self->ip + 1, .mode = mode1};
-
-        ArgMode mode2 = (op_and_mode / 1000) % 10;
-        Arg arg2 = {.pos = self->ip + 2, .mode = mode2};
-
-        ArgMode mode3 = (op_and_mode / 10000) % 10;
-        Arg arg3 = {.pos = self->ip + 3, .mode = mode3};
-
-        long result;
-
-        switch (op) {
-        case OP_ADD:
-            result = prog_memget(self, arg1) + prog_memget(self, arg2);
-            prog_memset(self, arg3, result);
-            self->ip += 4;
-            break;
-
-        case OP_MUL:
-            result = prog_memget(self, arg1) * prog_memget(self, arg2);
-            prog_memset(self, arg3, result);
-            self->ip += 4;
-            break;
-
-        case OP_READ:
-            if (g_queue_is_empty(self->input)) {
-                return STATE_WAIT_INPUT;
-            } else {
-                result = queue_pop(self->input);
-                prog_memset(self, arg1, result);
-                self->ip += 2;
-            }
-            break;
-
-        case OP_WRITE:
-            result = prog_memget(self, arg1);
-            queue_push(self->output, result);
-            self->ip += 2;
-            break;
-
-        case OP_JUMP_TRUE:
-            if (prog_memget(self, arg1) != 0)
-                self->ip = prog_memget(self, arg2);
-            else
-                self->ip += 3;
-            break;
-
-        case OP_JUMP_FALSE:
-            if (prog_memget(self, arg1) == 0)
-                self->ip = prog_memget(self, arg2);
-            else
-                self->ip += 3;
-            break;
-
-        case OP_LESS:
-            result = prog_memget(self, arg1) < prog_memget(self, arg2);
-            prog_memset(self, arg3, result);
-            self->ip += 4;
-            break;
-
-        case OP_EQUAL:
-            result = prog_memget(self, arg1) == prog_memget(self, arg2);
-            prog_memset(self, arg3, result);
-            self->ip += 4;
-            break;
-
-        case OP_MV_BASE:
-            self->rel_base += prog_memget(self, arg1);
-            self->ip += 2;
-            break;
-
-        case OP_HALT:
-            self->halted = true;
-            return STATE_HALT;
-
-        default:
-            return STATE_PROG_ERROR;
-        }
-    }
+static GArray *
+parse_input() {
+    AocInputReader *reader = aoc_input_reader_new_mapped("day09");
+    if (reader == NULL)
+        return NULL;
+
+    size_t len, err_offset;
+    const char *data = aoc_input_reader_get_data(reader, &len);
+    GArray *values = aoc_input_parse_num_list(data, len, ',', &err_offset);
+    if (values == NULL)
+        aoc_die("Parse number error at offset %zu\n", err_offset);
+
+    g_object_unref(reader);
+    return values;
 }
 
-static long
-prog_memget(Prog *self, Arg arg) {
-    switch (arg.mode) {
-    case ARG_MODE_POS:
-    case ARG_MODE_REL:
-        assert(arg.pos >= 0);
-        arg.pos = (long)g_hash_table_lookup(self->mem, GSIZE_TO_POINTER((size_t)arg.pos));
-        arg.pos += arg.mode == ARG_MODE_REL ? self->rel_base : 0;
-        // fall through
-    case ARG_MODE_IMM:
-        assert(arg.pos >= 0);
-        return (long)g_hash_table_lookup(self->mem, GSIZE_TO_POINTER((size_t)arg.pos));
-    default:
-        aoc_die("Invalid ArgMode %d\n", arg.mode);
+
+#ifndef TEST
+
+int
+main(int argc, char **argv) {
+    GArray *prog_data = parse_input();
+    if (prog_data == NULL)
+        aoc_die("Error parsing the input\n");
+
+    long result = solve(prog_data, 1);
+    printf("Part 1: result = %ld\n", result);
+
+    result = solve(prog_data, 2);
+    printf("Part 2: result = %ld\n", result);
+
+    g_array_free(prog_data, TRUE);
+    return 0;
+}
+
+#else
+
+static GArray *
+run_program(long *input, size_t size) {
+    GArray *prog = g_array_new(FALSE, FALSE, sizeof(long));
+    g_array_append_vals(prog, input, size);
+
+    Intcode computer;
+    intcode_init(&computer, prog);
+
+    GArray *output = g_array_new(FALSE, FALSE, sizeof(long));
+    IntcodeState rc;
+    long val;
+    do {
+        rc = intcode_run(&computer);
+        while (intcode_output_pop(&computer, &val))
+            g_array_append_val(output, val);
+    } while (rc == STATE_WAIT_OUTPUT);
+    g_assert_cmpint(rc, ==, STATE_HALT);
+
+    intcode_deinit(&computer);
+    g_array_free(prog, TRUE);
+    return output;
+}
+
+void
+test_quine() {
+    long input[] = {109,1,204,-1,1001,100,1,100,1008,100,16,101,1006,101,0,99};
+    GArray *output = run_program(input, sizeof(input) / sizeof(long));
+    g_assert_cmpmem(output->data, output->len * sizeof(long), input, sizeof(input));
+    g_array_free(output, TRUE);
+}
+
+void
+test_big_numbers() {
+    long input1[] = {1102,34915192,34915192,7,4,7,99,0};
+    GArray *output = run_program(input1, sizeof(input1) / sizeof(long));
+    g_assert_cmpint(output->len, ==, 1);
+    g_assert_cmpint(g_array_index(output, long, 0), ==, 1219070632396864);
+    g_array_free(output, TRUE);
+
+    long input2[] = {104,1125899906842624,99};
+    output = run_program(input2, sizeof(input2) / sizeof(long));
+    g_assert_cmpint(output->len, ==, 1);
+    g_assert_cmpint(g_array_index(output, long, 0), ==, 1125899906842624);
+    g_array_free(output, TRUE);
+}
+
+void
+test_far_memory() {
+    // write and read back cells in the dense area and in the sparse pages
+    long input[] = {1101,5,6,1000,1101,7,8,100000000,4,1000,4,100000000,4,100000001,99};
+    GArray *output = run_program(input, sizeof(input) / sizeof(long));
+    long expect[] = {11, 15, 0};
+    g_assert_cmpmem(output->data, output->len * sizeof(long), expect, sizeof(expect));
+    g_array_free(output, TRUE);
+}
+
+void
+test_self_modifying() {
+    // the first instruction is overwritten with OP_HALT after running once
+    long input[] = {104,1,1101,0,99,0,1105,1,0};
+    GArray *output = run_program(input, sizeof(input) / sizeof(long));
+    long expect[] = {1};
+    g_assert_cmpmem(output->data, output->len * sizeof(long), expect, sizeof(expect));
+    g_array_free(output, TRUE);
+}
+
+void
+test_long_output() {
+    // output more values than fit in the output channel
+    long input[] = {1101,0,0,100,4,100,1001,100,1,100,1008,100,5000,101,1006,101,4,99};
+    GArray *output = run_program(input, sizeof(input) / sizeof(long));
+    g_assert_cmpint(output->len, ==, 5000);
+    for (long i = 0; i < 5000; i++)
+        g_assert_cmpint(g_array_index(output, long, i), ==, i);
+    g_array_free(output, TRUE);
+}
+
+static void
+assert_ring(IntcodeSched sched) {
+    // each node passes x + 1 to the next one, until x reaches 2000
+    long input[] = {3,100,1007,100,2000,101,1005,101,12,4,100,99,101,1,100,100,4,100,1105,1,0};
+    GArray *prog = g_array_new(FALSE, FALSE, sizeof(long));
+    g_array_append_vals(prog, input, sizeof(input) / sizeof(long));
+
+    Intcode ring[32];
+    for (size_t i = 0; i < 32; i++)
+        intcode_init(&ring[i], prog);
+    for (size_t i = 0; i < 32; i++)
+        intcode_connect(&ring[i], &ring[(i + 1) % 32]);
+    intcode_input_push(&ring[0], 0);
+
+    g_assert_cmpint(intcode_run_all(ring, 32, sched), ==, STATE_HALT);
+
+    size_t left = 0;
+    long val;
+    for (size_t i = 0; i < 32; i++) {
+        while (intcode_chan_pop(ring[i].input, &val)) {
+            g_assert_cmpint(val, ==, 2000);
+            left++;
+        }
     }
+    g_assert_cmpint(left, ==, 1);
+
+    for (size_t i = 0; i < 32; i++)
+        intcode_deinit(&ring[i]);
+    g_array_free(prog, TRUE);
 }
 
 static void
-prog_memset(Prog *self, Arg arg, long val) {
-    if (arg.mode == ARG_MODE_IMM)
-        aoc_die("ARG_MODE_IMM not allowed for set operation\n");
+assert_stuck(IntcodeSched sched) {
+    long input[] = {3,10,4,10,99};
+    GArray *prog = g_array_new(FALSE, FALSE, sizeof(long));
+    g_array_append_vals(prog, input, sizeof(input) / sizeof(long));
+
+    Intcode pair[2];
+    intcode_init(&pair[0], prog);
+    intcode_init(&pair[1], prog);
+    intcode_connect(&pair[0], &pair[1]);
+    intcode_connect(&pair[1], &pair[0]);
+
+    g_assert_cmpint(intcode_run_all(pair, 2, sched), ==, STATE_WAIT_INPUT);
+
+    intcode_deinit(&pair[0]);
+    intcode_deinit(&pair[1]);
+    g_array_free(prog, TRUE);
+}
 
-    assert(arg.pos >= 0);
-    arg.pos = (long)g_hash_table_lookup(self->mem, GSIZE_TO_POINTER((size_t)arg.pos));
-    arg.pos += arg.mode == ARG_MODE_REL ? self->rel_base : 0;
-    assert(arg.pos >= 0);
-    g_hash_table_insert(self->mem, GSIZE_TO_POINTER((size_t)arg.pos), (gpointer)val);
+void
+test_run_all_cooperative() {
+    assert_ring(INTCODE_SCHED_COOPERATIVE);
+    assert_stuck(INTCODE_SCHED_COOPERATIVE);
 }
 
 void
-prog_init(Prog *self, const GArray *prog_data) {
-    static_assert(sizeof(gpointer) >= sizeof(long), "gpointer size < long size");
+test_run_all_threaded() {
+    assert_ring(INTCODE_SCHED_THREADED);
+    assert_stuck(INTCODE_SCHED_THREADED);
+}
 
-    self->mem = g_hash_table_new(g_direct_hash, g_direct_equal);
-    self->ip = 0;
-    self->rel_base = 0;
-    self->input = g_queue_new();
-    self->output = g_queue_new();
-    self->halted = false;
+static void
+assert_snapshot_fork(long addr) {
+    // loop: read a value into addr, write it doubled
+    long input[] = {3,addr,1002,addr,2,addr,4,addr,1105,1,0};
+    GArray *prog = g_array_new(FALSE, FALSE, sizeof(long));
+    g_array_append_vals(prog, input, sizeof(input) / sizeof(long));
+
+    Intcode base, child1, child2;
+    long val;
+    intcode_init(&base, prog);
+    intcode_input_push(&base, 1);
+    g_assert_cmpint(intcode_run(&base), ==, STATE_WAIT_INPUT);
+    IntcodeSnapshot *snap = intcode_snapshot_new(&base);
+    intcode_deinit(&base);
+
+    intcode_fork(&child1, snap);
+    intcode_fork(&child2, snap);
+    for (int i = 0; i < 2; i++) {
+        g_assert_true(intcode_output_pop(&child1, &val));
+        g_assert_cmpint(val, ==, 2);
+        intcode_input_push(&child1, 5);
+        g_assert_cmpint(intcode_run(&child1), ==, STATE_WAIT_INPUT);
+        g_assert_true(intcode_output_pop(&child1, &val));
+        g_assert_cmpint(val, ==, 10);
+        g_assert_cmpint(intcode_mem_get(&child2, addr), ==, 2);
+        intcode_reset(&child1);
+    }
 
-    for (gsize i = 0; i < prog_data->len; i++)
-        g_hash_table_insert(self->mem, GSIZE_TO_POINTER(i), (gpointer)g_array_index(prog_data, long, i));
+    g_assert_true(intcode_output_pop(&child2, &val));
+    intcode_input_push(&child2, 7);
+    g_assert_cmpint(intcode_run(&child2), ==, STATE_WAIT_INPUT);
+    g_assert_true(intcode_output_pop(&child2, &val));
+    g_assert_cmpint(val, ==, 14);
+
+    intcode_deinit(&child1);
+    intcode_deinit(&child2);
+    intcode_snapshot_free(snap);
+    g_array_free(prog, TRUE);
 }
 
-static void
-prog_deinit(Prog *self) {
-    g_hash_table_unref(self->mem);
-    g_queue_free(self->input);
-    g_queue_free(self->output);
+void
+test_batch() {
+    // y = x < 5 ? x * 2 : x + 100, then count x down to 0 in c
+    long input[] = {1007,31,5,32, 1005,32,15, 1001,31,100,33, 1105,1,19, 0,
+                    1002,31,2,33, 1001,31,-1,31, 1001,34,1,34, 1005,31,19, 99,
+                    0,0,0,0};
+    GArray *prog = g_array_new(FALSE, FALSE, sizeof(long));
+    g_array_append_vals(prog, input, sizeof(input) / sizeof(long));
+
+    IntcodeBatch batch;
+    intcode_batch_init(&batch, prog, 11);
+    for (size_t lane = 0; lane < 11; lane++)
+        intcode_batch_mem_set(&batch, lane, 31, lane + 1);
+    intcode_batch_mem_set(&batch, 9, 23, 1002);  // c *= 1, stays 0
+    intcode_batch_mem_set(&batch, 10, 0, 3);     // I/O, only in scalar mode
+    intcode_batch_run(&batch);
+
+    for (size_t lane = 0; lane < 10; lane++) {
+        Intcode computer;
+        intcode_init(&computer, prog);
+        intcode_mem_set(&computer, 31, lane + 1);
+        if (lane == 9)
+            intcode_mem_set(&computer, 23, 1002);
+        g_assert_cmpint(intcode_run(&computer), ==, STATE_HALT);
+
+        g_assert_cmpint(batch.state[lane], ==, STATE_HALT);
+        for (long addr = 0; addr < (long)prog->len; addr++)
+            g_assert_cmpint(intcode_batch_mem_get(&batch, lane, addr), ==, intcode_mem_get(&computer, addr));
+        intcode_deinit(&computer);
+    }
+    g_assert_cmpint(batch.state[10], ==, STATE_PROG_ERROR);
+    g_assert_cmpint(batch.stop_ip[10], ==, 0);
+
+    intcode_batch_reset(&batch);
+    g_assert_cmpint(intcode_batch_mem_get(&batch, 9, 23), ==, 1001);
+    g_assert_cmpint(intcode_batch_mem_get(&batch, 3, 33), ==, 0);
+
+    intcode_batch_deinit(&batch);
+    g_array_free(prog, TRUE);
 }
 
-static GArray *
-parse_input() {
-    AocInputReader *reader = aoc_input_reader_new("day09");
-    if (reader == NULL)
-        return NULL;
+void
+test_profile() {
+    if (!intcode_profile_available()) {
+        g_test_skip("Intcode library built without the intcode_profile option");
+        return;
+    }
 
-    GArray *values = g_array_new(FALSE, FALSE, sizeof(long));
-    if (values == NULL)
-        goto out;
+    // out(in * 2), twice
+    long input[] = {3,13, 1002,13,2,14, 4,14, 1105,1,0, 99, 99, 0,0};
+    GArray *prog = g_array_new(FALSE, FALSE, sizeof(long));
+    g_array_append_vals(prog, input, sizeof(input) / sizeof(long));
+
+    Intcode computer;
+    intcode_init(&computer, prog);
+    IntcodeProfile *profile = intcode_profile_new();
+    intcode_set_profile(&computer, profile);
+
+    g_assert_cmpint(intcode_run(&computer), ==, STATE_WAIT_INPUT);
+    g_assert_cmpuint(intcode_profile_op_count(profile, OP_READ), ==, 0);
+    intcode_input_push(&computer, 21);
+    intcode_input_push(&computer, 4);
+    g_assert_cmpint(intcode_run(&computer), ==, STATE_WAIT_INPUT);
+
+    g_assert_cmpuint(intcode_profile_op_count(profile, OP_READ), ==, 2);
+    g_assert_cmpuint(intcode_profile_op_count(profile, OP_MUL), ==, 2);
+    g_assert_cmpuint(intcode_profile_op_count(profile, OP_WRITE), ==, 2);
+    g_assert_cmpuint(intcode_profile_op_count(profile, OP_JUMP_TRUE), ==, 2);
+    g_assert_cmpuint(intcode_profile_op_count(profile, OP_HALT), ==, 0);
+    g_assert_cmpuint(intcode_profile_ip_count(profile, 0), ==, 2);
+    g_assert_cmpuint(intcode_profile_ip_count(profile, 8), ==, 2);
+    g_assert_cmpuint(intcode_profile_ip_count(profile, 11), ==, 0);
+
+    IntcodeProfile *total = intcode_profile_new();
+    intcode_profile_merge(total, profile);
+    intcode_profile_merge(total, profile);
+    g_assert_cmpuint(intcode_profile_op_count(total, OP_MUL), ==, 4);
+    g_assert_cmpuint(intcode_profile_ip_count(total, 2), ==, 4);
+
+    intcode_set_profile(&computer, NULL);
+    intcode_deinit(&computer);
+    intcode_profile_free(profile);
+    intcode_profile_free(total);
+    g_array_free(prog, TRUE);
+}
 
-    char *token;
-    while ((token = aoc_input_reader_getdelim(reader, ',')) != NULL) {
-        long val = aoc_input_parse_num(token);
-        if (val == PARSE_NUM_ERR)
-            aoc_die("Parse number error (%s)\n", token);
+void
+test_aot() {
+    const char *path = g_test_get_filename(G_TEST_DIST, "day09.txt", NULL);
+    char *data;
+    size_t len, err_offset;
+    g_assert_true(g_file_get_contents(path, &data, &len, NULL));
+    GArray *prog = aoc_input_parse_num_list(data, len, ',', &err_offset);
+    g_assert_nonnull(prog);
+
+    Intcode compiled, interpreted;
+    intcode_init(&compiled, prog);
+    if (compiled.compiled == NULL) {
+        g_test_skip("Built without the intcode_aot option");
+        intcode_deinit(&compiled);
+        g_array_free(prog, TRUE);
+        g_free(data);
+        return;
+    }
+    intcode_init(&interpreted, prog);
+    interpreted.compiled = NULL;
+
+    for (long mode = 1; mode <= 2; mode++) {
+        intcode_reset(&compiled);
+        intcode_reset(&interpreted);
+        interpreted.compiled = NULL;
+        intcode_input_push(&compiled, mode);
+        intcode_input_push(&interpreted, mode);
+        g_assert_cmpint(intcode_run(&compiled), ==, intcode_run(&interpreted));
+        g_assert_false(compiled.compiled_stale);
+        g_assert_cmpuint(compiled.insn_count, ==, interpreted.insn_count);
+
+        long a, b;
+        while (intcode_output_pop(&interpreted, &a)) {
+            g_assert_true(intcode_output_pop(&compiled, &b));
+            g_assert_cmpint(a, ==, b);
+        }
+        g_assert_false(intcode_output_pop(&compiled, &b));
+    }
+
+    // rewriting the compiled code falls back to the interpreter
+    intcode_reset(&compiled);
+    intcode_mem_set(&compiled, 0, g_array_index(prog, long, 0));
+    g_assert_false(compiled.compiled_stale);
+    intcode_mem_set(&compiled, 0, 99);
+    g_assert_true(compiled.compiled_stale);
+    g_assert_cmpint(intcode_run(&compiled), ==, STATE_HALT);
+    g_assert_cmpuint(compiled.insn_count, ==, 1);
+
+    intcode_deinit(&compiled);
+    intcode_deinit(&interpreted);
+    g_array_free(prog, TRUE);
+    g_free(data);
+}
 
-        g_array_append_val(values, val);
+/* Compiled code that interprets every instruction, like the step path of intcode_aot */
+static bool
+aot_run_steps(Intcode *vm, IntcodeState *state) {
+    while (intcode_step(vm, state)) {
+        if (vm->compiled_stale)
+            return false;
     }
+    return true;
+}
 
-out:
-    g_object_unref(reader);
-    return values;
+void
+test_aot_step_stale() {
+    // a computed jump to 12 rewrites the constant output by 19 through rb
+    long input[] = {109,20,5,30,31,1105,1,16,1101,0,0,32,21101,7,0,0,1105,1,19,104,5,99,
+                    0,0,0,0,0,0,0,0,1,12,0};
+    guint8 frozen[G_N_ELEMENTS(input)] = {0};
+    for (size_t i = 0; i < 22; i++)
+        frozen[i] = 1;
+    IntcodeCompiled compiled = {input, frozen, G_N_ELEMENTS(input), aot_run_steps};
+    GArray *prog = g_array_new(FALSE, FALSE, sizeof(long));
+    g_array_append_vals(prog, input, G_N_ELEMENTS(input));
+
+    Intcode computer;
+    intcode_init(&computer, prog);
+    intcode_set_jit(&computer, false);
+    computer.compiled = &compiled;
+    g_assert_cmpint(intcode_run(&computer), ==, STATE_HALT);
+    g_assert_true(computer.compiled_stale);
+    long out;
+    g_assert_true(intcode_output_pop(&computer, &out));
+    g_assert_cmpint(out, ==, 7);
+
+    intcode_deinit(&computer);
+    g_array_free(prog, TRUE);
 }
 
+/* Run prog with the JIT and with the interpreter, they must do the same */
+static void
+assert_jit_same(GArray *prog, long input) {
+    Intcode jit, interpreted;
+    intcode_init(&jit, prog);
+    intcode_init(&interpreted, prog);
+    g_assert_true(intcode_set_jit(&jit, true));
+    intcode_set_jit(&interpreted, false);
+    interpreted.compiled = NULL;
+
+    intcode_input_push(&jit, input);
+    intcode_input_push(&interpreted, input);
+    g_assert_cmpint(intcode_run(&jit), ==, intcode_run(&interpreted));
+    g_assert_cmpint(jit.ip, ==, interpreted.ip);
+    g_assert_cmpint(jit.rel_base, ==, interpreted.rel_base);
+    g_assert_cmpuint(jit.insn_count, ==, interpreted.insn_count);
+
+    long a, b;
+    while (intcode_output_pop(&interpreted, &a)) {
+        g_assert_true(intcode_output_pop(&jit, &b));
+        g_assert_cmpint(a, ==, b);
+    }
+    g_assert_false(intcode_output_pop(&jit, &b));
 
-int
-main(int argc, char **argv) {
-    GArray *prog_data = parse_input();
-    if (prog_data == NULL)
-        aoc_die("Error parsing the input\n");
+    intcode_deinit(&jit);
+    intcode_deinit(&interpreted);
+}
 
-    long result = solve(prog_data, 1);
-    printf("Part 1: result = %ld\n", result);
+static void
+assert_jit_file(const char *name, long input_1, long input_2) {
+    const char *path = g_test_get_filename(G_TEST_DIST, name, NULL);
+    char *data;
+    size_t len, err_offset;
+    g_assert_true(g_file_get_contents(path, &data, &len, NULL));
+    GArray *prog = aoc_input_parse_num_list(data, len, ',', &err_offset);
+    g_assert_nonnull(prog);
+    assert_jit_same(prog, input_1);
+    assert_jit_same(prog, input_2);
+    g_array_free(prog, TRUE);
+    g_free(data);
+}
 
-    result = solve(prog_data, 2);
-    printf("Part 2: result = %ld\n", result);
+void
+test_jit() {
+    if (!intcode_jit_available()) {
+        g_test_skip("No JIT for this platform");
+        return;
+    }
+    assert_jit_file("day09.txt", 1, 2);
+    assert_jit_file("day05.txt", 1, 5);
+
+    // a hot loop that sums 1..40 by rewriting the address of its own add
+    long input[100] = {1,50,90,90, 1001,1,1,1, 1001,91,-1,91, 1005,91,0, 4,90, 99};
+    for (long i = 0; i < 40; i++)
+        input[50 + i] = i + 1;
+    input[91] = 40;
+    GArray *prog = g_array_new(FALSE, FALSE, sizeof(long));
+    g_array_append_vals(prog, input, sizeof(input) / sizeof(long));
+    assert_jit_same(prog, 0);
+
+    Intcode computer;
+    intcode_init(&computer, prog);
+    intcode_set_jit(&computer, true);
+    g_assert_cmpint(intcode_run(&computer), ==, STATE_HALT);
+    long sum;
+    g_assert_true(intcode_output_pop(&computer, &sum));
+    g_assert_cmpint(sum, ==, 820);
+    intcode_deinit(&computer);
+    g_array_free(prog, TRUE);
+}
 
-    g_array_free(prog_data, TRUE);
-    return 0;
+void
+test_snapshot_fork() {
+    assert_snapshot_fork(100);      // small memory, copied
+    assert_snapshot_fork(100000);   // big memory, mapped copy-on-write
+}
+
+int
+main(int argc, char **argv) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/day09/test_quine", test_quine);
+    g_test_add_func("/day09/test_big_numbers", test_big_numbers);
+    g_test_add_func("/day09/test_far_memory", test_far_memory);
+    g_test_add_func("/day09/test_self_modifying", test_self_modifying);
+    g_test_add_func("/day09/test_long_output", test_long_output);
+    g_test_add_func("/day09/test_run_all_cooperative", test_run_all_cooperative);
+    g_test_add_func("/day09/test_run_all_threaded", test_run_all_threaded);
+    g_test_add_func("/day09/test_snapshot_fork", test_snapshot_fork);
+    g_test_add_func("/day09/test_batch", test_batch);
+    g_test_add_func("/day09/test_profile", test_profile);
+    g_test_add_func("/day09/test_aot", test_aot);
+    g_test_add_func("/day09/test_aot_step_stale", test_aot_step_stale);
+    g_test_add_func("/day09/test_jit", test_jit);
+
+    return g_test_run();
 }
+
+#endif
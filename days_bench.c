@@ -0,0 +1,515 @@
+#include "aoc_error.h"
+#include <fcntl.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PROGRESS_MOD 1000003
+// addresses of the variables of the generated Intcode programs, right after the jump over them
+#define VAR_BASE 3
+#define N_VARS 8
+
+/*
+ * Synthetic input of a day: the file dayXX.txt in the working directory of
+ * the runs and/or the arguments of the program. items counts the units of
+ * work, in unit, for the throughput.
+ */
+typedef struct {
+    GString *text;
+    GPtrArray *args;
+    guint64 items;
+    const char *unit;
+} BenchInput;
+
+typedef void generate_fn(BenchInput *input, guint scale, GRand *rand);
+
+static void
+gen_day01(BenchInput *input, guint scale, GRand *rand) {
+    input->items = 5000000ul * scale;
+    input->unit = "masses";
+    for (guint64 i = 0; i < input->items; i++)
+        g_string_append_printf(input->text, "%d\n", g_rand_int_range(rand, 1000, 1000000));
+}
+
+/* A random walk of n segments, that doesn't go back over the previous one */
+static void
+gen_wire(GString *text, guint64 n, GRand *rand) {
+    static const char dirs[] = "URDL";
+    int last = -1;
+    for (guint64 i = 0; i < n; i++) {
+        int dir;
+        do {
+            dir = g_rand_int_range(rand, 0, 4);
+        } while (last >= 0 && dir == (last + 2) % 4);
+        last = dir;
+        g_string_append_printf(text, "%s%c%d", i > 0 ? "," : "", dirs[dir], g_rand_int_range(rand, 1, 1000));
+    }
+    g_string_append_c(text, '\n');
+}
+
+static void
+gen_day03(BenchInput *input, guint scale, GRand *rand) {
+    guint64 n = 200000ul * scale;
+    gen_wire(input->text, n, rand);
+    gen_wire(input->text, n, rand);
+    input->items = 2 * n;
+    input->unit = "segments";
+}
+
+/* The list of the passwords of 16 + scale digits (up to 18) */
+static void
+gen_day04(BenchInput *input, guint scale, GRand *rand) {
+    guint digits = MIN(16 + scale, 18);
+    guint64 min = 1;
+    for (guint i = 1; i < digits; i++)
+        min *= 10;
+    g_ptr_array_add(input->args, g_strdup_printf("--min=%" G_GUINT64_FORMAT, min));
+    g_ptr_array_add(input->args, g_strdup_printf("--max=%" G_GUINT64_FORMAT, min * 10 - 1));
+    g_ptr_array_add(input->args, g_strdup("--list=part1"));
+    // the candidates are the non-decreasing numbers without zeros: digits + 8 choose 8
+    input->items = 1;
+    for (guint i = 1; i <= 8; i++)
+        input->items = input->items * (digits + i) / i;
+    input->unit = "candidates";
+}
+
+/* A tree of random shape, with some long branches, and YOU and SAN as far leaves */
+static void
+gen_day06(BenchInput *input, guint scale, GRand *rand) {
+    guint32 n = 1000000u * scale;
+    g_string_append(input->text, "COM)B1\n");
+    for (guint32 id = 2; id < n; id++) {
+        guint32 parent = g_rand_int_range(rand, 0, 8) == 0 ? id - 1 : g_rand_int_range(rand, 1, id);
+        g_string_append_printf(input->text, "B%x)B%x\n", parent, id);
+    }
+    g_string_append_printf(input->text, "B%x)YOU\nB%x)SAN\n", n - 1, n / 2);
+    input->items = n + 2;
+    input->unit = "orbits";
+}
+
+static void
+gen_day08(BenchInput *input, guint scale, GRand *rand) {
+    input->items = 500000ul * scale;
+    input->unit = "layers";
+    for (guint64 i = 0; i < input->items * 25 * 6; i++)
+        g_string_append_c(input->text, '0' + g_rand_int_range(rand, 0, 3));
+    g_string_append_c(input->text, '\n');
+}
+
+/*
+ * Minimal Intcode assembler: each argument is a mode and a value. The
+ * programs start with a jump over N_VARS variables at VAR_BASE.
+ */
+#define P(addr) ARG_POS, (long)(addr)
+#define I(val) ARG_IMM, (long)(val)
+// a variable, through the relative base (set to VAR_BASE) if rel
+#define V(rel, var) (rel) ? ARG_REL : ARG_POS, (long)((rel) ? (var) : VAR_BASE + (var))
+
+enum { ARG_POS = 0, ARG_IMM = 1, ARG_REL = 2 };
+enum { VAR_IN, VAR_I, VAR_ACC, VAR_T, VAR_F, VAR_CNT, VAR_PH, VAR_X };
+
+static void
+emit(GArray *prog, int op, int n_args, ...) {
+    va_list ap;
+    va_start(ap, n_args);
+    long insn = op, mode_mul = 100, args[3];
+    for (int i = 0; i < n_args; i++) {
+        insn += va_arg(ap, int) * mode_mul;
+        args[i] = va_arg(ap, long);
+        mode_mul *= 10;
+    }
+    va_end(ap);
+
+    g_array_append_val(prog, insn);
+    g_array_append_vals(prog, args, n_args);
+}
+
+static GArray *
+prog_begin(void) {
+    GArray *prog = g_array_new(FALSE, TRUE, sizeof(long));
+    emit(prog, 5, 2, I(1), I(VAR_BASE + N_VARS));
+    g_array_set_size(prog, VAR_BASE + N_VARS);
+    return prog;
+}
+
+/* acc = t % PROGRESS_MOD, if t < 2 * PROGRESS_MOD */
+static void
+emit_reduce(GArray *prog, bool rel) {
+    emit(prog, 7, 3, V(rel, VAR_T), I(PROGRESS_MOD), V(rel, VAR_F));
+    emit(prog, 2, 3, V(rel, VAR_F), I(PROGRESS_MOD), V(rel, VAR_F));
+    emit(prog, 1, 3, V(rel, VAR_T), V(rel, VAR_F), V(rel, VAR_ACC));
+    emit(prog, 1, 3, V(rel, VAR_ACC), I(-PROGRESS_MOD), V(rel, VAR_ACC));
+}
+
+/* acc = (2 * acc + add) % PROGRESS_MOD, that never overflows */
+static void
+emit_progress_step(GArray *prog, int add_var, bool rel) {
+    emit(prog, 2, 3, V(rel, VAR_ACC), I(2), V(rel, VAR_T));
+    emit_reduce(prog, rel);
+    emit(prog, 1, 3, V(rel, VAR_ACC), V(rel, add_var), V(rel, VAR_T));
+    emit_reduce(prog, rel);
+}
+
+static void
+prog_print(GString *text, GArray *prog) {
+    for (guint i = 0; i < prog->len; i++)
+        g_string_append_printf(text, "%s%ld", i > 0 ? "," : "", g_array_index(prog, long, i));
+    g_string_append_c(text, '\n');
+    g_array_free(prog, TRUE);
+}
+
+/*
+ * A straight line of additions and multiplications in position mode, like
+ * the gravity assist programs. The cell 0 ends up as 100 * noun + verb plus
+ * constants, that add up to 19690720 for a random noun and verb, and the
+ * rest of the instructions work on scratch cells.
+ */
+static void
+gen_day02(BenchInput *input, guint scale, GRand *rand) {
+    guint n_insns = 200000 * scale;
+    long data = 4 * (n_insns + 4) + 1;  // after the code and the HALT
+    long n_consts = 32, n_scratch = 32;
+    long one = data, hundred = data + 1, result = data + n_consts, last_const = data + n_consts - 1;
+    long consts[32];
+    for (long i = 0; i < n_consts; i++)
+        consts[i] = i == 0 ? 1 : i == 1 ? 100 : g_rand_int_range(rand, 0, 10);
+
+    GArray *prog = g_array_new(FALSE, TRUE, sizeof(long));
+    emit(prog, 1, 3, P(0), P(0), P(3));
+    emit(prog, 2, 3, P(1), P(hundred), P(result));
+    emit(prog, 1, 3, P(result), P(2), P(result));
+    long sum = 0;
+    for (guint i = 0; i < n_insns; i++) {
+        long k = g_rand_int_range(rand, 2, n_consts - 1);
+        long src = result + g_rand_int_range(rand, 1, n_scratch);
+        long dst = result + g_rand_int_range(rand, 1, n_scratch);
+        switch (g_rand_int_range(rand, 0, 4)) {
+        case 0:
+            emit(prog, 1, 3, P(result), P(data + k), P(result));
+            sum += consts[k];
+            break;
+        case 1:
+            emit(prog, 2, 3, P(src), P(one), P(dst));
+            break;
+        default:
+            emit(prog, 1, 3, P(src), P(data + k), P(dst));
+        }
+    }
+    // in the second square of candidates that part 2 tries
+    long noun = g_rand_int_range(rand, 32, 64), verb = g_rand_int_range(rand, 0, 64);
+    consts[n_consts - 1] = 19690720 - 100 * noun - verb - sum;
+    emit(prog, 1, 3, P(result), P(last_const), P(0));
+
+    long halt = 99;
+    g_array_append_val(prog, halt);
+    g_array_append_vals(prog, consts, n_consts);
+    g_array_set_size(prog, prog->len + n_scratch);
+
+    input->items = n_insns;
+    input->unit = "instructions";
+    prog_print(input->text, prog);
+}
+
+/* Read a value, then iterate the progress step on it n times and output the result */
+static GArray *
+gen_loop_prog(guint64 n, bool rel) {
+    GArray *prog = prog_begin();
+    if (rel)
+        emit(prog, 9, 1, I(VAR_BASE));
+    emit(prog, 3, 1, V(rel, VAR_IN));
+    emit(prog, 1, 3, I(0), I(n), V(rel, VAR_I));
+    emit(prog, 1, 3, V(rel, VAR_IN), I(0), V(rel, VAR_ACC));
+    long loop = prog->len;
+    emit_progress_step(prog, VAR_IN, rel);
+    emit(prog, 1, 3, V(rel, VAR_I), I(-1), V(rel, VAR_I));
+    emit(prog, 5, 2, V(rel, VAR_I), I(loop));
+    emit(prog, 4, 1, V(rel, VAR_ACC));
+    emit(prog, 99, 0);
+    return prog;
+}
+
+static void
+gen_day05(BenchInput *input, guint scale, GRand *rand) {
+    input->items = 5000000ul * scale * 2;
+    input->unit = "iterations";
+    prog_print(input->text, gen_loop_prog(5000000ul * scale, false));
+}
+
+static void
+gen_day09(BenchInput *input, guint scale, GRand *rand) {
+    input->items = 5000000ul * scale * 2;
+    input->unit = "iterations";
+    prog_print(input->text, gen_loop_prog(5000000ul * scale, true));
+}
+
+/*
+ * An amplifier: read the phase, then for each input value output it after
+ * n_work progress steps. Phases < 5 (part 1) stop after one value, and the
+ * others after n_values, like the feedback loop of part 2.
+ */
+static void
+gen_day07(BenchInput *input, guint scale, GRand *rand) {
+    long n_values = 100 * scale, n_work = 100;
+    GArray *prog = prog_begin();
+    emit(prog, 3, 1, V(false, VAR_PH));
+    emit(prog, 7, 3, V(false, VAR_PH), I(5), V(false, VAR_F));
+    emit(prog, 2, 3, V(false, VAR_F), I(1 - n_values), V(false, VAR_CNT));
+    emit(prog, 1, 3, V(false, VAR_CNT), I(n_values), V(false, VAR_CNT));
+
+    long loop = prog->len;
+    emit(prog, 3, 1, V(false, VAR_X));
+    emit(prog, 1, 3, V(false, VAR_X), I(0), V(false, VAR_ACC));
+    emit(prog, 1, 3, I(0), I(n_work), V(false, VAR_I));
+    long work = prog->len;
+    emit_progress_step(prog, VAR_PH, false);
+    emit(prog, 1, 3, V(false, VAR_I), I(-1), V(false, VAR_I));
+    emit(prog, 5, 2, V(false, VAR_I), I(work));
+    emit(prog, 4, 1, V(false, VAR_ACC));
+    emit(prog, 1, 3, V(false, VAR_CNT), I(-1), V(false, VAR_CNT));
+    emit(prog, 5, 2, V(false, VAR_CNT), I(loop));
+    emit(prog, 99, 0);
+
+    // 120 permutations of 5 amplifiers, of 1 value in part 1 and n_values in part 2
+    input->items = 120 * 5 * (1 + n_values) * n_work;
+    input->unit = "steps";
+    prog_print(input->text, prog);
+}
+
+typedef struct {
+    const char *day;
+    generate_fn *generate;
+} DayBench;
+
+static const DayBench days[] = {
+    {"day01", gen_day01},
+    {"day02", gen_day02},
+    {"day03", gen_day03},
+    {"day04", gen_day04},
+    {"day05", gen_day05},
+    {"day06", gen_day06},
+    {"day07", gen_day07},
+    {"day08", gen_day08},
+    {"day09", gen_day09},
+};
+
+typedef struct {
+    gint64 wall_us;
+    long max_rss_kb;
+} RunResult;
+
+/* Run the program in dir with its output discarded, and measure it */
+static bool
+run_once(const char *dir, char **argv, RunResult *result) {
+    gint64 start = g_get_monotonic_time();
+    pid_t pid = fork();
+    if (pid < 0)
+        aoc_die("fork failed\n");
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0 || chdir(dir) != 0)
+            _exit(127);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid)
+        aoc_die("wait4 failed\n");
+    result->wall_us = g_get_monotonic_time() - start;
+    result->max_rss_kb = usage.ru_maxrss;
+
+    if (WIFSIGNALED(status)) {
+        fprintf(stderr, "%s killed by signal %d\n", argv[0], WTERMSIG(status));
+        return false;
+    }
+    if (WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "%s exited with status %d\n", argv[0], WEXITSTATUS(status));
+        return false;
+    }
+    return true;
+}
+
+static gint
+compare_gint64(gconstpointer a, gconstpointer b) {
+    gint64 la = *(const gint64 *)a, lb = *(const gint64 *)b;
+    return (la > lb) - (la < lb);
+}
+
+/* Nearest rank percentile of the sorted times */
+static gint64
+percentile(const gint64 *sorted, guint n, guint pct) {
+    guint rank = (pct * n + 99) / 100;
+    return sorted[MAX(rank, 1) - 1];
+}
+
+/*
+ * The baseline is a text file with a line per benchmark:
+ * "DAY SCALE P50_US PEAK_RSS_KB". Only the results of the same scale are
+ * compared.
+ */
+typedef struct {
+    guint scale;
+    gint64 p50_us;
+    long rss_kb;
+} Baseline;
+
+static GHashTable *
+baseline_load(const char *path) {
+    GHashTable *baseline = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    char *text;
+    if (!g_file_get_contents(path, &text, NULL, NULL))
+        return baseline;
+
+    char **lines = g_strsplit(text, "\n", -1);
+    for (char **line = lines; *line != NULL; line++) {
+        char day[16];
+        Baseline *entry = g_new(Baseline, 1);
+        if (sscanf(*line, "%15s %u %" G_GINT64_FORMAT " %ld", day, &entry->scale, &entry->p50_us, &entry->rss_kb) == 4)
+            g_hash_table_insert(baseline, g_strdup(day), entry);
+        else
+            g_free(entry);
+    }
+    g_strfreev(lines);
+    g_free(text);
+    return baseline;
+}
+
+static bool
+baseline_save(GHashTable *baseline, const char *path) {
+    GList *days_list = g_list_sort(g_hash_table_get_keys(baseline), (GCompareFunc)strcmp);
+    GString *text = g_string_new(NULL);
+    for (GList *l = days_list; l != NULL; l = l->next) {
+        const Baseline *entry = g_hash_table_lookup(baseline, l->data);
+        g_string_append_printf(text, "%s %u %" G_GINT64_FORMAT " %ld\n", (char *)l->data, entry->scale,
+                               entry->p50_us, entry->rss_kb);
+    }
+    g_list_free(days_list);
+
+    bool ok = g_file_set_contents(path, text->str, text->len, NULL);
+    if (!ok)
+        fprintf(stderr, "Can't write the baseline to %s\n", path);
+    g_string_free(text, TRUE);
+    return ok;
+}
+
+/* Print the change against the baseline, and return false if it's worse than tolerance percent */
+static bool
+baseline_compare(const Baseline *base, const Baseline *cur, double tolerance) {
+    double time_pct = 100.0 * (cur->p50_us - base->p50_us) / base->p50_us;
+    double rss_pct = 100.0 * (cur->rss_kb - base->rss_kb) / base->rss_kb;
+    bool ok = time_pct <= tolerance && rss_pct <= tolerance;
+    printf("  vs baseline: p50 %+.1f%%, peak RSS %+.1f%%%s\n", time_pct, rss_pct, ok ? "" : "  REGRESSION");
+    return ok;
+}
+
+static gint opt_runs = 10;
+static gint opt_scale = 1;
+static gchar *opt_baseline = NULL;
+static gboolean opt_update = FALSE;
+static gdouble opt_tolerance = 10.0;
+
+static GOptionEntry options[] = {
+    {"runs", 'r', 0, G_OPTION_ARG_INT, &opt_runs, "Measured runs, after a warm-up one (default: 10)", "N"},
+    {"scale", 's', 0, G_OPTION_ARG_INT, &opt_scale, "Size factor of the synthetic input (default: 1)", "N"},
+    {"baseline", 'b', 0, G_OPTION_ARG_FILENAME, &opt_baseline, "Compare with the results saved in FILE, or save them if it has none of this day", "FILE"},
+    {"update-baseline", 'u', 0, G_OPTION_ARG_NONE, &opt_update, "Save the results in the baseline file, replacing the previous ones", NULL},
+    {"tolerance", 0, 0, G_OPTION_ARG_DOUBLE, &opt_tolerance, "Fail if the median time or the peak RSS are this percent worse than the baseline (default: 10)", "PCT"},
+    {NULL}
+};
+
+int
+main(int argc, char **argv) {
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("DAY PROGRAM - Benchmark a day with a synthetic input");
+    g_option_context_add_main_entries(context, options, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+        aoc_die("Option parsing failed: %s\n", error->message);
+    g_option_context_free(context);
+    if (argc != 3 || opt_runs < 1 || opt_scale < 1)
+        aoc_die("Usage: %s [OPTION...] DAY PROGRAM\n", argv[0]);
+
+    const DayBench *bench = NULL;
+    for (size_t i = 0; i < G_N_ELEMENTS(days); i++) {
+        if (strcmp(days[i].day, argv[1]) == 0)
+            bench = &days[i];
+    }
+    if (bench == NULL)
+        aoc_die("No benchmark for %s\n", argv[1]);
+
+    BenchInput input = {g_string_new(NULL), g_ptr_array_new_with_free_func(g_free), 0, NULL};
+    g_ptr_array_add(input.args, g_strdup(argv[2]));
+    GRand *rand = g_rand_new_with_seed(2019);
+    bench->generate(&input, opt_scale, rand);
+    g_rand_free(rand);
+    g_ptr_array_add(input.args, NULL);
+
+    char *dir = g_dir_make_tmp("aoc-bench-XXXXXX", &error);
+    if (dir == NULL)
+        aoc_die("Can't create the input directory: %s\n", error->message);
+    char *input_name = g_strdup_printf("%s.txt", bench->day);
+    char *input_path = g_build_filename(dir, input_name, NULL);
+    if (!g_file_set_contents(input_path, input.text->str, input.text->len, &error))
+        aoc_die("Can't write the input: %s\n", error->message);
+
+    bool ok = true;
+    gint64 *times = g_new(gint64, opt_runs);
+    long max_rss_kb = 0;
+    for (gint i = -1; i < opt_runs && ok; i++) {
+        RunResult result;
+        ok = run_once(dir, (char **)input.args->pdata, &result);
+        if (i >= 0) {
+            times[i] = result.wall_us;
+            max_rss_kb = MAX(max_rss_kb, result.max_rss_kb);
+        }
+    }
+
+    g_unlink(input_path);
+    g_rmdir(dir);
+
+    if (ok) {
+        qsort(times, opt_runs, sizeof(gint64), (int (*)(const void *, const void *))compare_gint64);
+        gint64 p50 = percentile(times, opt_runs, 50);
+        printf("%s: %" G_GUINT64_FORMAT " %s, %zu bytes of input, %d runs\n", bench->day, input.items, input.unit,
+               input.text->len, opt_runs);
+        printf("  time: min %.3f s, p50 %.3f s, p90 %.3f s, p99 %.3f s, max %.3f s\n", times[0] / 1e6, p50 / 1e6,
+               percentile(times, opt_runs, 90) / 1e6, percentile(times, opt_runs, 99) / 1e6,
+               times[opt_runs - 1] / 1e6);
+        printf("  throughput: %.2f M%s/s", input.items / (double)p50, input.unit);
+        if (input.text->len >= 1000000)
+            printf(", %.1f MB/s of input", input.text->len / (double)p50);
+        printf("\n");
+        printf("  peak RSS: %ld KiB\n", max_rss_kb);
+
+        Baseline current = {opt_scale, p50, max_rss_kb};
+        if (opt_baseline != NULL) {
+            GHashTable *baseline = baseline_load(opt_baseline);
+            const Baseline *base = g_hash_table_lookup(baseline, bench->day);
+            if (base != NULL && base->scale == (guint)opt_scale && !opt_update) {
+                ok = baseline_compare(base, &current, opt_tolerance);
+            } else {
+                Baseline *entry = g_new(Baseline, 1);
+                *entry = current;
+                g_hash_table_insert(baseline, g_strdup(bench->day), entry);
+                ok = baseline_save(baseline, opt_baseline);
+                printf("  saved as baseline in %s\n", opt_baseline);
+            }
+            g_hash_table_destroy(baseline);
+        }
+    }
+
+    g_free(times);
+    g_free(input_path);
+    g_free(input_name);
+    g_free(dir);
+    g_string_free(input.text, TRUE);
+    g_ptr_array_free(input.args, TRUE);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
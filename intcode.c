@@ -0,0 +1,1006 @@
+#define _GNU_SOURCE // memfd_create
+#include "intcode.h"
+#include "intcode_aot.h"
+#include "intcode_jit.h"
+#include "aoc_error.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef INTCODE_THREADED
+#define INTCODE_THREADED 0
+#endif
+
+#ifndef INTCODE_PROFILE
+#define INTCODE_PROFILE 0
+#endif
+
+#if INTCODE_THREADED && !defined(__GNUC__)
+#error "The threaded Intcode dispatch needs the labels as values GNU C extension"
+#endif
+
+// the handlers expand the memory accessors many times, don't let the
+// compiler give up inlining them
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+/*
+ * One handler per opcode and combination of addressing modes. The decoded
+ * instruction records store the handler index, and both dispatch backends
+ * expand the same handler bodies from this list.
+ */
+#define ARITH_M3(X, op, m1, m2) X(op, m1, m2, POS) X(op, m1, m2, REL)
+#define ARITH_M2(X, op, m1) ARITH_M3(X, op, m1, POS) ARITH_M3(X, op, m1, IMM) ARITH_M3(X, op, m1, REL)
+#define ARITH(X, op) ARITH_M2(X, op, POS) ARITH_M2(X, op, IMM) ARITH_M2(X, op, REL)
+#define JUMP_M2(X, op, m1) X(op, m1, POS) X(op, m1, IMM) X(op, m1, REL)
+#define JUMP(X, op) JUMP_M2(X, op, POS) JUMP_M2(X, op, IMM) JUMP_M2(X, op, REL)
+
+#define INSN_LIST(X3, X2, X1, X0) \
+    ARITH(X3, ADD) ARITH(X3, MUL) ARITH(X3, LESS) ARITH(X3, EQUAL) \
+    JUMP(X2, JUMP_TRUE) JUMP(X2, JUMP_FALSE) \
+    X1(READ, POS) X1(READ, REL) \
+    X1(WRITE, POS) X1(WRITE, IMM) X1(WRITE, REL) \
+    X1(MV_BASE, POS) X1(MV_BASE, IMM) X1(MV_BASE, REL) \
+    X0(HALT) X0(INVALID) X0(BAD_MODE)
+
+#define INSN_ID3(op, m1, m2, m3) INSN_##op##_##m1##_##m2##_##m3,
+#define INSN_ID2(op, m1, m2) INSN_##op##_##m1##_##m2,
+#define INSN_ID1(op, m1) INSN_##op##_##m1,
+#define INSN_ID0(op) INSN_##op,
+
+enum {
+    INSN_UNDECODED = 0,
+    INSN_LIST(INSN_ID3, INSN_ID2, INSN_ID1, INSN_ID0)
+    INSN_COUNT
+};
+
+static_assert(INSN_COUNT <= 256, "IntcodeInsn can't hold all the handlers");
+
+static long mem_get_slow(IntcodeMem *mem, long addr);
+static void mem_set_slow(IntcodeMem *mem, long addr, long val);
+
+static ALWAYS_INLINE long
+mem_get(IntcodeMem *mem, long addr) {
+    if ((size_t)addr < mem->len)
+        return mem->data[addr];
+    return mem_get_slow(mem, addr);
+}
+
+static ALWAYS_INLINE void
+mem_set(IntcodeMem *mem, long addr, long val) {
+    if ((size_t)addr < mem->len) {
+        mem->data[addr] = val;
+        mem->code[addr] = INSN_UNDECODED;
+    } else {
+        mem_set_slow(mem, addr, val);
+    }
+}
+
+static long
+mem_get_slow(IntcodeMem *mem, long addr) {
+    if (addr < 0)
+        aoc_die("Intcode: read from negative address %ld\n", addr);
+    if ((size_t)addr < INTCODE_DENSE_MAX || mem->pages == NULL)
+        return 0;
+
+    long *page = g_hash_table_lookup(mem->pages, GSIZE_TO_POINTER(addr / INTCODE_PAGE_SIZE));
+    return page != NULL ? page[addr % INTCODE_PAGE_SIZE] : 0;
+}
+
+static void
+mem_set_slow(IntcodeMem *mem, long addr, long val) {
+    if (addr < 0)
+        aoc_die("Intcode: write to negative address %ld\n", addr);
+
+    if ((size_t)addr < INTCODE_DENSE_MAX) {
+        size_t new_len = MAX(mem->len * 2, (size_t)addr + 1);
+        new_len = MIN(new_len, INTCODE_DENSE_MAX);
+        if (mem->map_size != 0) {
+            // copy-on-write mapping of a snapshot, move it to the heap
+            long *data = g_new(long, new_len);
+            IntcodeInsn *code = g_new(IntcodeInsn, new_len);
+            memcpy(data, mem->data, mem->len * sizeof(long));
+            memcpy(code, mem->code, mem->len * sizeof(IntcodeInsn));
+            munmap(mem->data, mem->map_size);
+            mem->data = data;
+            mem->code = code;
+            mem->map_size = 0;
+        } else {
+            mem->data = g_renew(long, mem->data, new_len);
+            mem->code = g_renew(IntcodeInsn, mem->code, new_len);
+        }
+        memset(mem->data + mem->len, 0, (new_len - mem->len) * sizeof(long));
+        memset(mem->code + mem->len, 0, (new_len - mem->len) * sizeof(IntcodeInsn));
+        mem->len = new_len;
+        mem->data[addr] = val;
+        return;
+    }
+
+    if (mem->pages == NULL)
+        mem->pages = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+    gpointer page_idx = GSIZE_TO_POINTER(addr / INTCODE_PAGE_SIZE);
+    long *page = g_hash_table_lookup(mem->pages, page_idx);
+    if (page == NULL) {
+        page = g_new0(long, INTCODE_PAGE_SIZE);
+        g_hash_table_insert(mem->pages, page_idx, page);
+    }
+    page[addr % INTCODE_PAGE_SIZE] = val;
+}
+
+static ALWAYS_INLINE IntcodeInsn
+insn_arith(IntcodeInsn first, int mode1, int mode2, int mode3) {
+    if (mode1 > ARG_MODE_REL || mode2 > ARG_MODE_REL || mode3 == ARG_MODE_IMM || mode3 > ARG_MODE_REL)
+        return INSN_BAD_MODE;
+    return first + (mode1 * 3 + mode2) * 2 + (mode3 == ARG_MODE_REL);
+}
+
+static ALWAYS_INLINE IntcodeInsn
+insn_jump(IntcodeInsn first, int mode1, int mode2) {
+    if (mode1 > ARG_MODE_REL || mode2 > ARG_MODE_REL)
+        return INSN_BAD_MODE;
+    return first + mode1 * 3 + mode2;
+}
+
+static IntcodeInsn
+insn_decode(long op_and_mode) {
+    if (op_and_mode < 0 || op_and_mode >= 100000)
+        return INSN_INVALID;
+
+    int mode1 = (op_and_mode / 100) % 10;
+    int mode2 = (op_and_mode / 1000) % 10;
+    int mode3 = (op_and_mode / 10000) % 10;
+
+    switch (op_and_mode % 100) {
+    case OP_ADD: return insn_arith(INSN_ADD_POS_POS_POS, mode1, mode2, mode3);
+    case OP_MUL: return insn_arith(INSN_MUL_POS_POS_POS, mode1, mode2, mode3);
+    case OP_LESS: return insn_arith(INSN_LESS_POS_POS_POS, mode1, mode2, mode3);
+    case OP_EQUAL: return insn_arith(INSN_EQUAL_POS_POS_POS, mode1, mode2, mode3);
+    case OP_JUMP_TRUE: return insn_jump(INSN_JUMP_TRUE_POS_POS, mode1, mode2);
+    case OP_JUMP_FALSE: return insn_jump(INSN_JUMP_FALSE_POS_POS, mode1, mode2);
+    case OP_READ:
+        if (mode1 == ARG_MODE_POS)
+            return INSN_READ_POS;
+        return mode1 == ARG_MODE_REL ? INSN_READ_REL : INSN_BAD_MODE;
+    case OP_WRITE:
+        return mode1 <= ARG_MODE_REL ? INSN_WRITE_POS + mode1 : INSN_BAD_MODE;
+    case OP_MV_BASE:
+        return mode1 <= ARG_MODE_REL ? INSN_MV_BASE_POS + mode1 : INSN_BAD_MODE;
+    case OP_HALT:
+        return INSN_HALT;
+    default:
+        return INSN_INVALID;
+    }
+}
+
+static ALWAYS_INLINE IntcodeInsn
+insn_fetch(IntcodeMem *mem, long ip) {
+    if ((size_t)ip < mem->len) {
+        IntcodeInsn *insn = &mem->code[ip];
+        if (G_UNLIKELY(*insn == INSN_UNDECODED))
+            *insn = insn_decode(mem->data[ip]);
+        return *insn;
+    }
+    return insn_decode(mem_get_slow(mem, ip));
+}
+
+struct _IntcodeProfile {
+    guint64 insns[INSN_COUNT];  // executed instructions by handler
+    guint64 *heat;              // executed instructions by ip
+    size_t heat_len;
+    guint64 heat_far;           // executed at ip >= INTCODE_DENSE_MAX
+    guint64 input_waits;
+    guint64 output_waits;
+    size_t mem_high;            // most memory cells used at once
+    guint64 runs;
+    gint64 wall_us;
+    bool from_env;              // created for INTCODE_PROFILE, see profile_env_new
+};
+
+static void
+profile_heat_grow(IntcodeProfile *prof, size_t len) {
+    size_t new_len = MIN(MAX(prof->heat_len * 2, len), INTCODE_DENSE_MAX);
+    prof->heat = g_renew(guint64, prof->heat, new_len);
+    memset(prof->heat + prof->heat_len, 0, (new_len - prof->heat_len) * sizeof(guint64));
+    prof->heat_len = new_len;
+}
+
+#if INTCODE_PROFILE
+static ALWAYS_INLINE void
+profile_step(IntcodeProfile *prof, IntcodeInsn insn, long ip) {
+    prof->insns[insn]++;
+    if (G_UNLIKELY((size_t)ip >= prof->heat_len)) {
+        if ((size_t)ip >= INTCODE_DENSE_MAX) {
+            prof->heat_far++;
+            return;
+        }
+        profile_heat_grow(prof, ip + 1);
+    }
+    prof->heat[ip]++;
+}
+
+/* Undo the count of an instruction that has to wait for I/O: it's fetched again when it resumes */
+static void
+profile_wait(IntcodeProfile *prof, guint64 *waits, IntcodeInsn insn, long ip) {
+    (*waits)++;
+    prof->insns[insn]--;
+    if ((size_t)ip < prof->heat_len)
+        prof->heat[ip]--;
+    else
+        prof->heat_far--;
+}
+
+static void
+profile_run_end(IntcodeProfile *prof, const IntcodeMem *mem, gint64 start) {
+    size_t cells = mem->len;
+    if (mem->pages != NULL)
+        cells += g_hash_table_size(mem->pages) * INTCODE_PAGE_SIZE;
+    prof->mem_high = MAX(prof->mem_high, cells);
+    prof->runs++;
+    prof->wall_us += g_get_monotonic_time() - start;
+}
+
+#define PROFILE_STEP(insn) if (prof != NULL) profile_step(prof, insn, ip)
+#define PROFILE_WAIT(waits, insn) if (prof != NULL) profile_wait(prof, &prof->waits, insn, ip)
+#else
+#define PROFILE_STEP(insn)
+#define PROFILE_WAIT(waits, insn)
+#endif
+
+#define RD_POS(pos) mem_get(mem, mem_get(mem, (pos)))
+#define RD_IMM(pos) mem_get(mem, (pos))
+#define RD_REL(pos) mem_get(mem, mem_get(mem, (pos)) + rel_base)
+#define WR_POS(pos, val) mem_set(mem, mem_get(mem, (pos)), (val))
+#define WR_REL(pos, val) mem_set(mem, mem_get(mem, (pos)) + rel_base, (val))
+
+#define BODY_ADD(m1, m2, m3) WR_##m3(ip + 3, RD_##m1(ip + 1) + RD_##m2(ip + 2)); ip += 4;
+#define BODY_MUL(m1, m2, m3) WR_##m3(ip + 3, RD_##m1(ip + 1) * RD_##m2(ip + 2)); ip += 4;
+#define BODY_LESS(m1, m2, m3) WR_##m3(ip + 3, RD_##m1(ip + 1) < RD_##m2(ip + 2)); ip += 4;
+#define BODY_EQUAL(m1, m2, m3) WR_##m3(ip + 3, RD_##m1(ip + 1) == RD_##m2(ip + 2)); ip += 4;
+#define BODY_JUMP_TRUE(m1, m2) ip = RD_##m1(ip + 1) != 0 ? RD_##m2(ip + 2) : ip + 3;
+#define BODY_JUMP_FALSE(m1, m2) ip = RD_##m1(ip + 1) == 0 ? RD_##m2(ip + 2) : ip + 3;
+#define BODY_WRITE(m1) \
+    if (!intcode_chan_push(self->output, RD_##m1(ip + 1))) { \
+        PROFILE_WAIT(output_waits, INSN_WRITE_##m1); \
+        state = STATE_WAIT_OUTPUT; \
+        goto out; \
+    } \
+    ip += 2;
+#define BODY_MV_BASE(m1) rel_base += RD_##m1(ip + 1); ip += 2;
+#define BODY_READ(m1) \
+    long input_val; \
+    if (!intcode_chan_pop(self->input, &input_val)) { \
+        PROFILE_WAIT(input_waits, INSN_READ_##m1); \
+        state = STATE_WAIT_INPUT; \
+        goto out; \
+    } \
+    WR_##m1(ip + 1, input_val); \
+    ip += 2;
+#define BODY_HALT \
+    self->halted = true; \
+    state = STATE_HALT; \
+    goto out;
+#define BODY_INVALID \
+    state = STATE_PROG_ERROR; \
+    goto out;
+#define BODY_BAD_MODE \
+    aoc_die("Intcode: invalid argument mode in %ld at ip %ld\n", mem_get(mem, ip), ip);
+
+#if INTCODE_THREADED
+#define HANDLER(name) L_##name:
+#define NEXT() do { \
+        steps++; \
+        IntcodeInsn insn = insn_fetch(mem, ip); \
+        PROFILE_STEP(insn); \
+        goto *handlers[insn]; \
+    } while (0)
+#else
+#define HANDLER(name) case INSN_##name:
+#define NEXT() break
+#endif
+
+#define HANDLER3(op, m1, m2, m3) HANDLER(op##_##m1##_##m2##_##m3) { BODY_##op(m1, m2, m3) } NEXT();
+#define HANDLER2(op, m1, m2) HANDLER(op##_##m1##_##m2) { BODY_##op(m1, m2) } NEXT();
+#define HANDLER1(op, m1) HANDLER(op##_##m1) { BODY_##op(m1) } NEXT();
+#define HANDLER0(op) HANDLER(op) { BODY_##op } NEXT();
+
+#define LABEL3(op, m1, m2, m3) [INSN_##op##_##m1##_##m2##_##m3] = &&L_##op##_##m1##_##m2##_##m3,
+#define LABEL2(op, m1, m2) [INSN_##op##_##m1##_##m2] = &&L_##op##_##m1##_##m2,
+#define LABEL1(op, m1) [INSN_##op##_##m1] = &&L_##op##_##m1,
+#define LABEL0(op) [INSN_##op] = &&L_##op,
+
+static IntcodeState
+interpret(Intcode *self) {
+    IntcodeMem *mem = &self->mem;
+    long ip = self->ip;
+    long rel_base = self->rel_base;
+    unsigned long steps = 0;
+    IntcodeState state;
+#if INTCODE_PROFILE
+    IntcodeProfile *prof = self->profile;
+    gint64 start = prof != NULL ? g_get_monotonic_time() : 0;
+#endif
+
+#if INTCODE_THREADED
+    static const void *const handlers[INSN_COUNT] = {
+        INSN_LIST(LABEL3, LABEL2, LABEL1, LABEL0)
+    };
+
+    NEXT();
+    INSN_LIST(HANDLER3, HANDLER2, HANDLER1, HANDLER0)
+#else
+    while (true) {
+        steps++;
+        IntcodeInsn insn = insn_fetch(mem, ip);
+        PROFILE_STEP(insn);
+        switch (insn) {
+        INSN_LIST(HANDLER3, HANDLER2, HANDLER1, HANDLER0)
+        default:
+            g_assert_not_reached();
+        }
+    }
+#endif
+
+out:
+    self->ip = ip;
+    self->rel_base = rel_base;
+    self->insn_count += steps;
+#if INTCODE_PROFILE
+    if (prof != NULL)
+        profile_run_end(prof, mem, start);
+#endif
+    return state;
+}
+
+IntcodeState
+intcode_run(Intcode *self) {
+    if (self->jit != NULL && self->profile == NULL)
+        return intcode_jit_run(self);
+    if (self->compiled != NULL && !self->compiled_stale && self->profile == NULL) {
+        IntcodeState state;
+        if (self->compiled->run(self, &state))
+            return state;
+        self->compiled_stale = true;
+    }
+    return interpret(self);
+}
+
+#define STEP3(op, m1, m2, m3) case INSN_##op##_##m1##_##m2##_##m3: { BODY_##op(m1, m2, m3) } break;
+#define STEP2(op, m1, m2) case INSN_##op##_##m1##_##m2: { BODY_##op(m1, m2) } break;
+#define STEP1(op, m1) case INSN_##op##_##m1: { BODY_##op(m1) } break;
+#define STEP0(op) case INSN_##op: { BODY_##op } break;
+
+/* The address that the instruction at ip is going to write, or -1 */
+static long
+step_write_addr(Intcode *self) {
+    long val = mem_get(&self->mem, self->ip);
+    if (val < 0)
+        return -1;
+    int arg;
+    switch (val % 100) {
+    case OP_ADD: case OP_MUL: case OP_LESS: case OP_EQUAL:
+        arg = 3;
+        break;
+    case OP_READ:
+        arg = 1;
+        break;
+    default:
+        return -1;
+    }
+
+    long mode = arg == 3 ? val / 10000 % 10 : val / 100 % 10;
+    long addr = mem_get(&self->mem, self->ip + arg);
+    if (mode == ARG_MODE_REL)
+        return addr + self->rel_base;
+    return mode == ARG_MODE_POS ? addr : -1;
+}
+
+/* The cell at addr is set to val, maybe over the compiled code */
+static void
+code_written(Intcode *self, long addr, long val) {
+    const IntcodeCompiled *compiled = self->compiled;
+    if (compiled != NULL && (size_t)addr < compiled->len && compiled->frozen[addr] && val != compiled->image[addr])
+        self->compiled_stale = true;
+    if (self->jit != NULL)
+        intcode_jit_written(self->jit, addr);
+}
+
+static bool
+step(Intcode *self, IntcodeState *state_out) {
+    IntcodeMem *mem = &self->mem;
+    long ip = self->ip;
+    long rel_base = self->rel_base;
+    IntcodeState state;
+#if INTCODE_PROFILE
+    IntcodeProfile *prof = self->profile;
+#endif
+
+    // the compiled code resets the decoded records of the cells it writes
+    self->insn_count++;
+    switch (insn_fetch(mem, ip)) {
+    INSN_LIST(STEP3, STEP2, STEP1, STEP0)
+    default:
+        g_assert_not_reached();
+    }
+    self->ip = ip;
+    self->rel_base = rel_base;
+    return true;
+
+out:
+    self->ip = ip;
+    self->rel_base = rel_base;
+    *state_out = state;
+    return false;
+}
+
+bool
+intcode_step(Intcode *self, IntcodeState *state) {
+    // the interpreter writes the cell directly: check it like intcode_mem_set
+    long addr = step_write_addr(self);
+    bool running = step(self, state);
+    if (addr >= 0)
+        code_written(self, addr, mem_get(&self->mem, addr));
+    return running;
+}
+
+#ifdef __GNUC__
+// defined only in the executables that link a program translated by intcode_aot
+extern const IntcodeCompiled intcode_aot_program __attribute__((weak));
+#endif
+
+/* The compiled program for the image, if any */
+static const IntcodeCompiled *
+compiled_lookup(const GArray *image) {
+#ifdef __GNUC__
+    const IntcodeCompiled *compiled = &intcode_aot_program;
+    if (compiled != NULL && compiled->len == image->len &&
+        memcmp(compiled->image, image->data, image->len * sizeof(long)) == 0)
+        return compiled;
+#endif
+    return NULL;
+}
+
+const char *
+intcode_dispatch_name(void) {
+    return INTCODE_THREADED ? "threaded" : "switch";
+}
+
+bool
+intcode_profile_available(void) {
+    return INTCODE_PROFILE;
+}
+
+IntcodeProfile *
+intcode_profile_new(void) {
+    return g_new0(IntcodeProfile, 1);
+}
+
+void
+intcode_profile_free(IntcodeProfile *profile) {
+    g_free(profile->heat);
+    g_free(profile);
+}
+
+void
+intcode_profile_merge(IntcodeProfile *dst, const IntcodeProfile *src) {
+    for (size_t i = 0; i < INSN_COUNT; i++)
+        dst->insns[i] += src->insns[i];
+    if (src->heat_len > dst->heat_len)
+        profile_heat_grow(dst, src->heat_len);
+    for (size_t ip = 0; ip < src->heat_len; ip++)
+        dst->heat[ip] += src->heat[ip];
+    dst->heat_far += src->heat_far;
+    dst->input_waits += src->input_waits;
+    dst->output_waits += src->output_waits;
+    dst->mem_high = MAX(dst->mem_high, src->mem_high);
+    dst->runs += src->runs;
+    dst->wall_us += src->wall_us;
+}
+
+typedef struct {
+    const char *op;
+    const char *name;
+    int n_args;
+    IntcodeArgMode modes[3];
+} InsnInfo;
+
+#define INFO3(op, m1, m2, m3) \
+    [INSN_##op##_##m1##_##m2##_##m3] = {#op, #op "_" #m1 "_" #m2 "_" #m3, 3, {ARG_MODE_##m1, ARG_MODE_##m2, ARG_MODE_##m3}},
+#define INFO2(op, m1, m2) [INSN_##op##_##m1##_##m2] = {#op, #op "_" #m1 "_" #m2, 2, {ARG_MODE_##m1, ARG_MODE_##m2}},
+#define INFO1(op, m1) [INSN_##op##_##m1] = {#op, #op "_" #m1, 1, {ARG_MODE_##m1}},
+#define INFO0(op) [INSN_##op] = {#op, #op, 0, {0}},
+
+static const InsnInfo insn_info[INSN_COUNT] = {
+    INSN_LIST(INFO3, INFO2, INFO1, INFO0)
+};
+
+static const char *const op_names[] = {
+    [OP_ADD] = "ADD", [OP_MUL] = "MUL", [OP_READ] = "READ", [OP_WRITE] = "WRITE",
+    [OP_JUMP_TRUE] = "JUMP_TRUE", [OP_JUMP_FALSE] = "JUMP_FALSE", [OP_LESS] = "LESS",
+    [OP_EQUAL] = "EQUAL", [OP_MV_BASE] = "MV_BASE", [OP_HALT] = "HALT",
+};
+
+static const char *const mode_names[] = {"POS", "IMM", "REL"};
+
+static guint64
+profile_op_count_by_name(const IntcodeProfile *profile, const char *op) {
+    guint64 count = 0;
+    for (size_t i = 1; i < INSN_COUNT; i++) {
+        if (strcmp(insn_info[i].op, op) == 0)
+            count += profile->insns[i];
+    }
+    return count;
+}
+
+guint64
+intcode_profile_op_count(const IntcodeProfile *profile, int op) {
+    if (op < 0 || (size_t)op >= G_N_ELEMENTS(op_names) || op_names[op] == NULL)
+        return 0;
+    return profile_op_count_by_name(profile, op_names[op]);
+}
+
+guint64
+intcode_profile_ip_count(const IntcodeProfile *profile, long ip) {
+    return ip >= 0 && (size_t)ip < profile->heat_len ? profile->heat[ip] : 0;
+}
+
+/* Writer of the report as JSON, an object (or a list) per section, or as CSV rows */
+typedef struct {
+    FILE *file;
+    bool csv;
+    const char *section;
+    bool list;
+    bool empty;
+} Report;
+
+static void
+report_section(Report *report, const char *section, bool list) {
+    if (!report->csv) {
+        if (report->section != NULL)
+            fprintf(report->file, "%s%s,\n", report->empty ? "" : "\n  ", report->list ? "]" : "}");
+        fprintf(report->file, "  \"%s\": %s", section, list ? "[" : "{");
+    }
+    report->section = section;
+    report->list = list;
+    report->empty = true;
+}
+
+static void
+report_row(Report *report, const char *key, guint64 count) {
+    if (report->csv)
+        fprintf(report->file, "%s,%s,%" G_GUINT64_FORMAT "\n", report->section, key, count);
+    else if (report->list)
+        fprintf(report->file, "%s\n    [%s, %" G_GUINT64_FORMAT "]", report->empty ? "" : ",", key, count);
+    else
+        fprintf(report->file, "%s\n    \"%s\": %" G_GUINT64_FORMAT, report->empty ? "" : ",", key, count);
+    report->empty = false;
+}
+
+static void
+report_write(Report *report, const IntcodeProfile *profile) {
+    guint64 insns = 0, mode_counts[3] = {0};
+    for (size_t i = 1; i < INSN_COUNT; i++) {
+        insns += profile->insns[i];
+        for (int arg = 0; arg < insn_info[i].n_args; arg++)
+            mode_counts[insn_info[i].modes[arg]] += profile->insns[i];
+    }
+
+    if (report->csv)
+        fputs("section,key,count\n", report->file);
+    else
+        fprintf(report->file, "{\n  \"dispatch\": \"%s\",\n", intcode_dispatch_name());
+
+    report_section(report, "summary", false);
+    report_row(report, "instructions", insns);
+    report_row(report, "runs", profile->runs);
+    report_row(report, "wall_us", profile->wall_us);
+    report_row(report, "input_waits", profile->input_waits);
+    report_row(report, "output_waits", profile->output_waits);
+    report_row(report, "memory_high_water", profile->mem_high);
+    report_row(report, "far_ip_instructions", profile->heat_far);
+
+    // the handlers of an opcode are consecutive
+    report_section(report, "opcodes", false);
+    for (size_t i = 1; i < INSN_COUNT; i++) {
+        if (i == 1 || strcmp(insn_info[i].op, insn_info[i - 1].op) != 0)
+            report_row(report, insn_info[i].op, profile_op_count_by_name(profile, insn_info[i].op));
+    }
+
+    report_section(report, "modes", false);
+    for (int mode = 0; mode < 3; mode++)
+        report_row(report, mode_names[mode], mode_counts[mode]);
+
+    report_section(report, "handlers", false);
+    for (size_t i = 1; i < INSN_COUNT; i++) {
+        if (profile->insns[i] != 0)
+            report_row(report, insn_info[i].name, profile->insns[i]);
+    }
+
+    // [ip, count] of the addresses executed at least once
+    report_section(report, "heatmap", true);
+    for (size_t ip = 0; ip < profile->heat_len; ip++) {
+        if (profile->heat[ip] != 0) {
+            char key[32];
+            snprintf(key, sizeof(key), "%zu", ip);
+            report_row(report, key, profile->heat[ip]);
+        }
+    }
+
+    if (!report->csv)
+        fprintf(report->file, "%s%s\n}\n", report->empty ? "" : "\n  ", report->list ? "]" : "}");
+}
+
+bool
+intcode_profile_write(const IntcodeProfile *profile, const char *path) {
+    Report report = {0};
+    report.file = fopen(path, "w");
+    if (report.file == NULL) {
+        fprintf(stderr, "Intcode: can't write the profile to %s\n", path);
+        return false;
+    }
+    report.csv = g_str_has_suffix(path, ".csv");
+    report_write(&report, profile);
+    if (fclose(report.file) != 0) {
+        fprintf(stderr, "Intcode: can't write the profile to %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+#if INTCODE_PROFILE
+static GMutex env_profile_lock;
+static IntcodeProfile *env_profile;     // merged profiles of the deinitialized computers
+static const char *env_profile_path;
+
+static void
+profile_env_write(void) {
+    g_mutex_lock(&env_profile_lock);
+    intcode_profile_write(env_profile, env_profile_path);
+    g_mutex_unlock(&env_profile_lock);
+}
+#endif
+
+/* A profile for a new computer, if INTCODE_PROFILE is set, see intcode_profile_available */
+static IntcodeProfile *
+profile_env_new(void) {
+#if INTCODE_PROFILE
+    static gsize init = 0;
+    if (g_once_init_enter(&init)) {
+        const char *path = g_getenv("INTCODE_PROFILE");
+        if (path != NULL && *path != '\0') {
+            env_profile_path = g_strdup(path);
+            env_profile = intcode_profile_new();
+            atexit(profile_env_write);
+        }
+        g_once_init_leave(&init, 1);
+    }
+    if (env_profile != NULL) {
+        IntcodeProfile *profile = intcode_profile_new();
+        profile->from_env = true;
+        return profile;
+    }
+#endif
+    return NULL;
+}
+
+static void
+profile_env_release(IntcodeProfile *profile) {
+#if INTCODE_PROFILE
+    if (profile == NULL || !profile->from_env)
+        return;
+    g_mutex_lock(&env_profile_lock);
+    intcode_profile_merge(env_profile, profile);
+    g_mutex_unlock(&env_profile_lock);
+    intcode_profile_free(profile);
+#endif
+}
+
+void
+intcode_set_profile(Intcode *self, IntcodeProfile *profile) {
+    profile_env_release(self->profile);
+    self->profile = profile;
+}
+
+bool
+intcode_set_jit(Intcode *self, bool enabled) {
+    if (!enabled) {
+        intcode_jit_free(self->jit);
+        self->jit = NULL;
+        return true;
+    }
+    if (self->jit == NULL)
+        self->jit = intcode_jit_new();
+    return self->jit != NULL;
+}
+
+long
+intcode_mem_get(Intcode *self, long addr) {
+    return mem_get(&self->mem, addr);
+}
+
+void
+intcode_mem_set(Intcode *self, long addr, long val) {
+    code_written(self, addr, val);
+    mem_set(&self->mem, addr, val);
+}
+
+void
+intcode_connect(Intcode *from, Intcode *to) {
+    from->output = to->input;
+}
+
+void
+intcode_chan_init(IntcodeChan *chan, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity)
+        size *= 2;
+
+    chan->buf = g_new(long, size);
+    chan->mask = size - 1;
+    chan->reader = NULL;
+    chan->writer = NULL;
+    intcode_chan_clear(chan);
+}
+
+void
+intcode_chan_deinit(IntcodeChan *chan) {
+    g_free(chan->buf);
+}
+
+void
+intcode_chan_clear(IntcodeChan *chan) {
+    atomic_store(&chan->head, 0);
+    atomic_store(&chan->tail, 0);
+    chan->head_cache = 0;
+    chan->tail_cache = 0;
+}
+
+struct _IntcodeSnapshot {
+    GArray *image;
+    long *data;
+    IntcodeInsn *code;
+    size_t len;
+    int fd;             // memfd holding data and code, -1 if they're on the heap
+    size_t map_size;
+    size_t code_offset;
+    GHashTable *pages;
+    long ip;
+    long rel_base;
+    unsigned long insn_count;
+    const IntcodeCompiled *compiled;
+    bool compiled_stale;
+    bool halted;
+    GArray *input;
+    GArray *output;
+};
+
+static GHashTable *
+pages_copy(GHashTable *pages) {
+    if (pages == NULL)
+        return NULL;
+
+    GHashTable *copy = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    GHashTableIter iter;
+    gpointer page_idx, page;
+    g_hash_table_iter_init(&iter, pages);
+    while (g_hash_table_iter_next(&iter, &page_idx, &page)) {
+        long *page_copy = g_new(long, INTCODE_PAGE_SIZE);
+        memcpy(page_copy, page, INTCODE_PAGE_SIZE * sizeof(long));
+        g_hash_table_insert(copy, page_idx, page_copy);
+    }
+    return copy;
+}
+
+static GArray *
+chan_copy(IntcodeChan *chan) {
+    GArray *values = g_array_new(FALSE, FALSE, sizeof(long));
+    size_t head = atomic_load(&chan->head);
+    size_t tail = atomic_load(&chan->tail);
+    for (size_t i = head; i != tail; i++)
+        g_array_append_val(values, chan->buf[i & chan->mask]);
+    return values;
+}
+
+static size_t
+page_align(size_t size) {
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+/*
+ * Restore the memory to src, the len first dense cells, and pages. Only the
+ * cells whose value changes lose their decoded record, and are written: on a
+ * copy-on-write mapping, the pages that didn't change stay shared.
+ */
+static void
+mem_restore(IntcodeMem *mem, const long *src, size_t len, GHashTable *pages) {
+    size_t dense_len = MIN(len, mem->len);
+    for (size_t i = 0; i < mem->len; i++) {
+        long val = i < dense_len ? src[i] : 0;
+        if (mem->data[i] != val) {
+            mem->data[i] = val;
+            mem->code[i] = INSN_UNDECODED;
+        }
+    }
+
+    if (mem->pages != NULL)
+        g_hash_table_destroy(mem->pages);
+    mem->pages = pages_copy(pages);
+    for (size_t i = dense_len; i < len; i++)
+        mem_set(mem, i, src[i]);
+}
+
+IntcodeSnapshot *
+intcode_snapshot_new(Intcode *self) {
+    IntcodeSnapshot *snap = g_new0(IntcodeSnapshot, 1);
+    IntcodeMem *mem = &self->mem;
+
+    snap->image = g_array_ref(self->image);
+    snap->len = mem->len;
+    snap->fd = -1;
+    if (mem->len * sizeof(long) >= INTCODE_COW_MIN) {
+        snap->code_offset = page_align(mem->len * sizeof(long));
+        snap->map_size = snap->code_offset + page_align(mem->len * sizeof(IntcodeInsn));
+
+        int fd = memfd_create("intcode-snapshot", MFD_CLOEXEC);
+        if (fd >= 0 && ftruncate(fd, snap->map_size) == 0) {
+            char *map = mmap(NULL, snap->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                snap->fd = fd;
+                snap->data = (long *)map;
+                snap->code = (IntcodeInsn *)(map + snap->code_offset);
+            }
+        }
+        if (snap->fd < 0 && fd >= 0)
+            close(fd);
+    }
+    if (snap->fd < 0) {
+        snap->data = g_new(long, mem->len);
+        snap->code = g_new(IntcodeInsn, mem->len);
+    }
+    memcpy(snap->data, mem->data, mem->len * sizeof(long));
+    memcpy(snap->code, mem->code, mem->len * sizeof(IntcodeInsn));
+    snap->pages = pages_copy(mem->pages);
+
+    snap->ip = self->ip;
+    snap->rel_base = self->rel_base;
+    snap->insn_count = self->insn_count;
+    snap->compiled = self->compiled;
+    snap->compiled_stale = self->compiled_stale;
+    snap->halted = self->halted;
+    snap->input = chan_copy(&self->chans[0]);
+    snap->output = chan_copy(&self->chans[1]);
+    return snap;
+}
+
+void
+intcode_snapshot_free(IntcodeSnapshot *snap) {
+    if (snap->fd >= 0) {
+        munmap(snap->data, snap->map_size);
+        close(snap->fd);
+    } else {
+        g_free(snap->data);
+        g_free(snap->code);
+    }
+    if (snap->pages != NULL)
+        g_hash_table_destroy(snap->pages);
+    g_array_free(snap->input, TRUE);
+    g_array_free(snap->output, TRUE);
+    g_array_unref(snap->image);
+    g_free(snap);
+}
+
+/* Whether the environment variable INTCODE_JIT is 1 */
+static bool
+jit_env_enabled(void) {
+    static gsize init = 0;
+    static bool enabled;
+    if (g_once_init_enter(&init)) {
+        enabled = intcode_jit_available() && g_strcmp0(g_getenv("INTCODE_JIT"), "1") == 0;
+        g_once_init_leave(&init, 1);
+    }
+    return enabled;
+}
+
+static void
+computer_init_common(Intcode *self, GArray *image) {
+    self->image = g_array_ref(image);
+    intcode_chan_init(&self->chans[0], INTCODE_CHAN_CAPACITY);
+    intcode_chan_init(&self->chans[1], INTCODE_CHAN_CAPACITY);
+    self->input = &self->chans[0];
+    self->output = &self->chans[1];
+    self->mem.pages = NULL;
+    self->profile = profile_env_new();
+    self->jit = jit_env_enabled() ? intcode_jit_new() : NULL;
+}
+
+void
+intcode_fork(Intcode *self, const IntcodeSnapshot *snap) {
+    computer_init_common(self, snap->image);
+    self->origin = snap;
+    self->mem.len = snap->len;
+
+    if (snap->fd >= 0) {
+        char *map = mmap(NULL, snap->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, snap->fd, 0);
+        if (map == MAP_FAILED)
+            aoc_die("Intcode: can't map snapshot memory\n");
+        self->mem.data = (long *)map;
+        self->mem.code = (IntcodeInsn *)(map + snap->code_offset);
+        self->mem.map_size = snap->map_size;
+    } else {
+        self->mem.data = g_new(long, snap->len);
+        self->mem.code = g_new(IntcodeInsn, snap->len);
+        self->mem.map_size = 0;
+        memcpy(self->mem.data, snap->data, snap->len * sizeof(long));
+        memcpy(self->mem.code, snap->code, snap->len * sizeof(IntcodeInsn));
+    }
+    intcode_reset(self);
+}
+
+void
+intcode_init(Intcode *self, const GArray *prog) {
+    static_assert(sizeof(gpointer) >= sizeof(long), "gpointer size < long size");
+
+    computer_init_common(self, (GArray *)prog);
+    self->origin = NULL;
+    self->mem.len = MIN(MAX(prog->len, 1u), INTCODE_DENSE_MAX);
+    self->mem.data = g_new0(long, self->mem.len);
+    self->mem.code = g_new0(IntcodeInsn, self->mem.len);
+    self->mem.map_size = 0;
+    intcode_reset(self);
+}
+
+void
+intcode_reset(Intcode *self) {
+    const IntcodeSnapshot *snap = self->origin;
+    if (self->jit != NULL)
+        intcode_jit_flush(self->jit);
+    intcode_chan_clear(&self->chans[0]);
+    intcode_chan_clear(&self->chans[1]);
+
+    if (snap == NULL) {
+        mem_restore(&self->mem, (long *)self->image->data, self->image->len, NULL);
+        self->ip = 0;
+        self->rel_base = 0;
+        self->insn_count = 0;
+        self->compiled = compiled_lookup(self->image);
+        self->compiled_stale = false;
+        self->halted = false;
+        return;
+    }
+
+    mem_restore(&self->mem, snap->data, snap->len, snap->pages);
+    self->ip = snap->ip;
+    self->rel_base = snap->rel_base;
+    self->insn_count = snap->insn_count;
+    self->compiled = snap->compiled;
+    self->compiled_stale = snap->compiled_stale;
+    self->halted = snap->halted;
+    for (size_t i = 0; i < snap->input->len; i++)
+        intcode_chan_push(&self->chans[0], g_array_index(snap->input, long, i));
+    for (size_t i = 0; i < snap->output->len; i++)
+        intcode_chan_push(&self->chans[1], g_array_index(snap->output, long, i));
+}
+
+void
+intcode_deinit(Intcode *self) {
+    if (self->mem.map_size != 0) {
+        munmap(self->mem.data, self->mem.map_size);
+    } else {
+        g_free(self->mem.data);
+        g_free(self->mem.code);
+    }
+    if (self->mem.pages != NULL)
+        g_hash_table_unref(self->mem.pages);
+    intcode_chan_deinit(&self->chans[0]);
+    intcode_chan_deinit(&self->chans[1]);
+    g_array_unref(self->image);
+    profile_env_release(self->profile);
+    intcode_jit_free(self->jit);
+}
@@ -0,0 +1,458 @@
+#ifndef INTCODE_H_
+#define INTCODE_H_
+
+#include <glib.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Addresses below this limit live in the dense memory array */
+#define INTCODE_DENSE_MAX (1ul << 20)
+/* Size (in cells) of the sparse pages used beyond INTCODE_DENSE_MAX */
+#define INTCODE_PAGE_SIZE 512ul
+/* Snapshots of smaller memories (in bytes) are copied instead of mapped
+ * copy-on-write: copying is cheaper than the page faults */
+#define INTCODE_COW_MIN (64ul * 1024)
+/* Default capacity of the I/O channels of a computer */
+#define INTCODE_CHAN_CAPACITY 1024ul
+/* Lanes of a batch are stepped in blocks of this size */
+#define INTCODE_BATCH_WIDTH 4
+/* Times the JIT interprets an address before compiling the block there */
+#define INTCODE_JIT_HOT 32
+
+typedef enum {
+    OP_ADD = 1,
+    OP_MUL = 2,
+    OP_READ = 3,
+    OP_WRITE = 4,
+    OP_JUMP_TRUE = 5,
+    OP_JUMP_FALSE = 6,
+    OP_LESS = 7,
+    OP_EQUAL = 8,
+    OP_MV_BASE = 9,
+    OP_HALT = 99
+} IntcodeOp;
+
+typedef enum {
+    ARG_MODE_POS = 0,
+    ARG_MODE_IMM = 1,
+    ARG_MODE_REL = 2
+} IntcodeArgMode;
+
+typedef enum {
+    STATE_HALT,
+    STATE_WAIT_INPUT,
+    STATE_WAIT_OUTPUT,
+    STATE_PROG_ERROR = -1
+} IntcodeState;
+
+typedef enum {
+    INTCODE_SCHED_COOPERATIVE,
+    INTCODE_SCHED_THREADED
+} IntcodeSched;
+
+/* A thread that can block waiting on a channel, see intcode_run_all */
+typedef struct _IntcodeWaiter IntcodeWaiter;
+
+/*
+ * Fixed capacity single producer / single consumer ring of values. It is
+ * lock-free: the producer and the consumer can be on different threads.
+ * Each side keeps a private copy of the other side's index, and only reads
+ * the shared one when the copy says the ring is full/empty.
+ * reader/writer are only set while the two sides are threads that block on
+ * the channel, and then they are woken when the channel changes.
+ */
+typedef struct {
+    long *buf;
+    size_t mask;
+    IntcodeWaiter *reader;
+    IntcodeWaiter *writer;
+    // consumer side
+    atomic_size_t head;
+    size_t tail_cache;
+    char pad[64];
+    // producer side
+    atomic_size_t tail;
+    size_t head_cache;
+} IntcodeChan;
+
+/*
+ * Decoded form of an instruction: the index of the handler specialised for
+ * its opcode and the addressing modes of its arguments. Records equal to 0
+ * are decoded lazily the next time the instruction pointer reaches them.
+ */
+typedef guint8 IntcodeInsn;
+
+typedef struct {
+    long *data;
+    IntcodeInsn *code;  // decoded instructions, same length as data
+    size_t len;
+    size_t map_size;    // if not 0, data and code are a copy-on-write mapping
+    GHashTable *pages;
+} IntcodeMem;
+
+/* Saved state of a computer, see intcode_snapshot_new */
+typedef struct _IntcodeSnapshot IntcodeSnapshot;
+
+/* Execution counters of one or more computers, see intcode_profile_new */
+typedef struct _IntcodeProfile IntcodeProfile;
+
+/* Program translated ahead of time to C, see intcode_aot.h */
+typedef struct _IntcodeCompiled IntcodeCompiled;
+
+/* Native code compiled at run time for a computer, see intcode_set_jit */
+typedef struct _IntcodeJit IntcodeJit;
+
+typedef struct {
+    GArray *image;
+    const IntcodeSnapshot *origin;
+    IntcodeMem mem;
+    long ip;
+    long rel_base;
+    unsigned long insn_count;
+    IntcodeProfile *profile;    // see intcode_set_profile
+    const IntcodeCompiled *compiled;
+    bool compiled_stale;        // the program changed the compiled code
+    IntcodeJit *jit;            // see intcode_set_jit
+    IntcodeChan *input;
+    IntcodeChan *output;
+    IntcodeChan chans[2]; // own input and output channels
+    bool halted;
+} Intcode;
+
+/*
+ * Many instances (lanes) of the same program, each one with its own memory,
+ * run in lockstep: each instruction is decoded once for all the lanes at the
+ * same instruction pointer. The memory is laid out as a struct of arrays,
+ * with the value of a cell for all the lanes contiguous.
+ * There is no I/O and the memory doesn't grow: lanes that reach an I/O
+ * instruction or write beyond the program stop with STATE_PROG_ERROR, and
+ * can be run again with intcode_run.
+ */
+typedef struct {
+    GArray *image;
+    size_t n_lanes;
+    size_t stride;          // n_lanes rounded up to INTCODE_BATCH_WIDTH
+    size_t len;             // memory cells of each lane
+    long *mem;              // cell addr of a lane at mem[addr * stride + lane]
+    long *ip;
+    long *stop_ip;          // ip where each lane halted or failed
+    long *rel_base;
+    IntcodeState *state;    // valid after intcode_batch_run
+    bool *dirty;            // cells written since the last reset
+} IntcodeBatch;
+
+/**
+ * Initialize a channel with room for at least capacity values
+ */
+void
+intcode_chan_init(IntcodeChan *chan, size_t capacity);
+
+/**
+ * Release the buffer of the channel
+ */
+void
+intcode_chan_deinit(IntcodeChan *chan);
+
+/**
+ * Discard the contents of the channel. Neither side can be using it.
+ */
+void
+intcode_chan_clear(IntcodeChan *chan);
+
+/**
+ * Wake up the waiter if it's blocked waiting on a channel
+ */
+void
+intcode_waiter_wake(IntcodeWaiter *waiter);
+
+/**
+ * Append val to the channel. Return false if it's full.
+ * Only the producer side can call it.
+ */
+static inline bool
+intcode_chan_push(IntcodeChan *chan, long val) {
+    size_t tail = atomic_load_explicit(&chan->tail, memory_order_relaxed);
+    if (tail - chan->head_cache > chan->mask) {
+        chan->head_cache = atomic_load_explicit(&chan->head, memory_order_acquire);
+        if (tail - chan->head_cache > chan->mask)
+            return false;
+    }
+
+    chan->buf[tail & chan->mask] = val;
+    atomic_store_explicit(&chan->tail, tail + 1, memory_order_release);
+    if (chan->reader != NULL)
+        intcode_waiter_wake(chan->reader);
+    return true;
+}
+
+/**
+ * Pop the oldest value of the channel into val. Return false if it's empty.
+ * Only the consumer side can call it.
+ */
+static inline bool
+intcode_chan_pop(IntcodeChan *chan, long *val) {
+    size_t head = atomic_load_explicit(&chan->head, memory_order_relaxed);
+    if (head == chan->tail_cache) {
+        chan->tail_cache = atomic_load_explicit(&chan->tail, memory_order_acquire);
+        if (head == chan->tail_cache)
+            return false;
+    }
+
+    *val = chan->buf[head & chan->mask];
+    atomic_store_explicit(&chan->head, head + 1, memory_order_release);
+    if (chan->writer != NULL)
+        intcode_waiter_wake(chan->writer);
+    return true;
+}
+
+/**
+ * Number of values in the channel. If the other side is running on another
+ * thread, it's only a snapshot.
+ */
+static inline size_t
+intcode_chan_len(IntcodeChan *chan) {
+    return atomic_load_explicit(&chan->tail, memory_order_acquire) -
+           atomic_load_explicit(&chan->head, memory_order_acquire);
+}
+
+/**
+ * Initialize an Intcode computer with a copy of the program prog (a GArray
+ * of long). Memory beyond the program is zero and grows on demand.
+ * The computer keeps a reference to prog: intcode_reset restores the contents
+ * it has at that moment.
+ */
+void
+intcode_init(Intcode *self, const GArray *prog);
+
+/**
+ * Restart the computer from the program it was initialized with, or from the
+ * snapshot it was forked from, reusing the allocated memory and the
+ * instructions already decoded. Its own input and output channels get the
+ * values they had in the snapshot, or are emptied.
+ */
+void
+intcode_reset(Intcode *self);
+
+/**
+ * Save the state of the computer: memory, decoded instructions, registers
+ * and the values pending in its own channels. Big memories are saved in a
+ * memfd that the forked computers map copy-on-write.
+ */
+IntcodeSnapshot *
+intcode_snapshot_new(Intcode *self);
+
+/**
+ * Release a snapshot. The computers forked from it must be deinitialized
+ * before.
+ */
+void
+intcode_snapshot_free(IntcodeSnapshot *snap);
+
+/**
+ * Initialize a computer with the state saved in snap. It shares the memory
+ * pages of the snapshot until it writes to them, and it doesn't need to
+ * decode again the instructions already decoded when the snapshot was made.
+ */
+void
+intcode_fork(Intcode *self, const IntcodeSnapshot *snap);
+
+/**
+ * Release the memory and the I/O channels of the computer
+ */
+void
+intcode_deinit(Intcode *self);
+
+/**
+ * Run the program until it halts, it needs an input value that is not
+ * available yet, its output channel is full, or it finds an invalid opcode.
+ * Calling it again after STATE_WAIT_INPUT/STATE_WAIT_OUTPUT resumes the
+ * execution.
+ * If the JIT is enabled (see intcode_set_jit), or else the program was
+ * compiled ahead of time (see intcode_aot.h), it runs native code, unless
+ * the computer is being profiled. The compiled program is abandoned if the
+ * program overwrites its code.
+ */
+IntcodeState
+intcode_run(Intcode *self);
+
+/**
+ * Execute only the instruction at ip, with the interpreter, for the compiled
+ * code that can't run it. Return false, with the state, if the computer
+ * stopped. Like intcode_mem_set, a write over the compiled code sets
+ * compiled_stale.
+ */
+bool
+intcode_step(Intcode *self, IntcodeState *state);
+
+/**
+ * Initialize a batch of n_lanes instances of the program prog (a GArray of
+ * long). Like intcode_init, it keeps a reference to prog.
+ */
+void
+intcode_batch_init(IntcodeBatch *self, const GArray *prog, size_t n_lanes);
+
+/**
+ * Restart all the lanes from the program the batch was initialized with
+ */
+void
+intcode_batch_reset(IntcodeBatch *self);
+
+/**
+ * Release the memory of the batch
+ */
+void
+intcode_batch_deinit(IntcodeBatch *self);
+
+/**
+ * Run all the lanes until each of them halts or fails. Lanes that take
+ * different branches are run separately, and run together again when their
+ * instruction pointers meet.
+ */
+void
+intcode_batch_run(IntcodeBatch *self);
+
+/**
+ * Read the memory cell at addr of a lane. Cells out of the memory read as 0.
+ */
+long
+intcode_batch_mem_get(IntcodeBatch *self, size_t lane, long addr);
+
+/**
+ * Write the memory cell at addr of a lane. It must be within the program.
+ */
+void
+intcode_batch_mem_set(IntcodeBatch *self, size_t lane, long addr, long val);
+
+/**
+ * Name of the dispatch backend this library was built with
+ */
+const char *
+intcode_dispatch_name(void);
+
+/**
+ * Run n connected computers until all of them halt. With
+ * INTCODE_SCHED_COOPERATIVE they run round-robin on the calling thread, each
+ * one until it blocks on I/O. With INTCODE_SCHED_THREADED each computer runs
+ * on its own thread, sleeping while its channel is empty (or full).
+ * Return STATE_HALT, STATE_PROG_ERROR if any computer failed, or the state
+ * of a blocked computer if they got stuck waiting on each other.
+ */
+IntcodeState
+intcode_run_all(Intcode *computers, size_t n, IntcodeSched sched);
+
+/**
+ * Whether this library was built with the intcode_profile option. If it
+ * wasn't, intcode_run doesn't collect anything and the profiles stay empty.
+ * If it was, and the environment variable INTCODE_PROFILE is a file name,
+ * each computer gets its own profile, that is merged into a profile of the
+ * whole process when the computer is deinitialized, and written to the file
+ * at exit.
+ */
+bool
+intcode_profile_available(void);
+
+/**
+ * Create an empty profile
+ */
+IntcodeProfile *
+intcode_profile_new(void);
+
+/**
+ * Release a profile. No computer can be using it.
+ */
+void
+intcode_profile_free(IntcodeProfile *profile);
+
+/**
+ * Add the counters of src to dst
+ */
+void
+intcode_profile_merge(IntcodeProfile *dst, const IntcodeProfile *src);
+
+/**
+ * Executed instructions with opcode op (an IntcodeOp), counting any
+ * addressing mode. Instructions that waited for I/O count when they resume.
+ */
+guint64
+intcode_profile_op_count(const IntcodeProfile *profile, int op);
+
+/**
+ * Executed instructions at the address ip
+ */
+guint64
+intcode_profile_ip_count(const IntcodeProfile *profile, long ip);
+
+/**
+ * Write the profile to path, as CSV if its name ends in ".csv", or as JSON
+ * otherwise: instructions by opcode, by handler (opcode and addressing
+ * modes) and by address, arguments by addressing mode, I/O waits, memory
+ * high-water mark (in cells) and wall time of intcode_run. Return false if
+ * the file can't be written.
+ */
+bool
+intcode_profile_write(const IntcodeProfile *profile, const char *path);
+
+/**
+ * Collect the counters of the computer in profile from now on, or stop
+ * collecting them if it's NULL. Several computers can share a profile only
+ * if they run on the same thread. The computer doesn't own the profile.
+ */
+void
+intcode_set_profile(Intcode *self, IntcodeProfile *profile);
+
+/**
+ * Whether the JIT is supported: only on x86-64 Linux. If it is, and the
+ * environment variable INTCODE_JIT is 1, it's enabled for all the computers.
+ */
+bool
+intcode_jit_available(void);
+
+/**
+ * Run the computer with the JIT from now on, or stop using it. The blocks of
+ * instructions that run often are compiled to native code, and compiled
+ * again if the program writes over them. Return false if the JIT isn't
+ * available.
+ */
+bool
+intcode_set_jit(Intcode *self, bool enabled);
+
+/**
+ * Read the memory cell at addr. Cells never written read as 0.
+ */
+long
+intcode_mem_get(Intcode *self, long addr);
+
+/**
+ * Write the memory cell at addr, growing the memory if needed.
+ */
+void
+intcode_mem_set(Intcode *self, long addr, long val);
+
+/**
+ * Send the output of the computer from to the input of the computer to,
+ * without intermediate copies. Each computer can run on its own thread.
+ * The connection persists after intcode_reset.
+ */
+void
+intcode_connect(Intcode *from, Intcode *to);
+
+/**
+ * Append a value to the input channel of the computer.
+ * Return false if the channel is full.
+ */
+static inline bool
+intcode_input_push(Intcode *self, long val) {
+    return intcode_chan_push(self->input, val);
+}
+
+/**
+ * Pop the oldest value from the output channel into val.
+ * Return false if the channel is empty.
+ */
+static inline bool
+intcode_output_pop(Intcode *self, long *val) {
+    return intcode_chan_pop(self->output, val);
+}
+
+#endif // INTCODE_H_
@@ -0,0 +1,385 @@
+#include "aoc_input.h"
+#include "aoc_error.h"
+#include "intcode.h"
+#include <glib.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Translator of an Intcode image to C, see intcode_aot.h. Every address
+ * reachable from 0, following the instructions and the jumps to fixed
+ * targets, gets a label with its instruction. Instructions jump to each
+ * other directly when the target is fixed, and through a switch on ip
+ * otherwise. The switch only enters at the starts of the blocks, so that the
+ * compiler can keep the cells in registers inside them. Other addresses are
+ * run by the interpreter, one instruction at a time, until they reach one.
+ * Cells that the instructions write to fixed addresses are read from memory
+ * at run time, and an opcode among them is checked before its instruction.
+ * The rest of the cells of the instructions (frozen) are compiled as
+ * constants: if the program writes over one through a computed address, the
+ * compiled code gives up.
+ */
+
+typedef struct {
+    int op;         // IntcodeOp, or 0 if it's not a valid instruction
+    int n_args;
+    int modes[3];
+} Insn;
+
+typedef struct {
+    const long *image;
+    long len;
+    Insn *insns;    // decoded as if there was an instruction at each address
+    bool *reachable;
+    bool *entry;    // where the execution can enter from the dispatch
+    bool *written;  // targets of the writes to fixed addresses
+    guint8 *frozen;
+    bool uses_stale;
+    bool uses_out;
+} Program;
+
+static Insn
+decode(const long *image, long len, long addr) {
+    Insn insn = {0};
+    long val = image[addr];
+    if (val < 0 || val >= 100000)
+        return insn;
+
+    int write_arg = 0;
+    switch (val % 100) {
+    case OP_ADD: case OP_MUL: case OP_LESS: case OP_EQUAL:
+        insn.n_args = 3;
+        write_arg = 3;
+        break;
+    case OP_JUMP_TRUE: case OP_JUMP_FALSE:
+        insn.n_args = 2;
+        break;
+    case OP_READ:
+        insn.n_args = 1;
+        write_arg = 1;
+        break;
+    case OP_WRITE: case OP_MV_BASE:
+        insn.n_args = 1;
+        break;
+    case OP_HALT:
+        break;
+    default:
+        return insn;
+    }
+
+    long modes = val / 100;
+    for (int i = 0; i < 3; i++, modes /= 10) {
+        insn.modes[i] = modes % 10;
+        if (i < insn.n_args && (insn.modes[i] > ARG_MODE_REL || (i + 1 == write_arg && insn.modes[i] == ARG_MODE_IMM)))
+            return insn;
+    }
+    if (addr + insn.n_args >= len)
+        return insn;
+
+    insn.op = val % 100;
+    return insn;
+}
+
+static bool
+is_jump(int op) {
+    return op == OP_JUMP_TRUE || op == OP_JUMP_FALSE;
+}
+
+static bool
+is_arith(int op) {
+    return op == OP_ADD || op == OP_MUL || op == OP_LESS || op == OP_EQUAL;
+}
+
+static void
+program_analyze(Program *prog) {
+    long len = prog->len;
+    prog->insns = g_new0(Insn, len);
+    prog->reachable = g_new0(bool, len);
+    prog->entry = g_new0(bool, len);
+    prog->written = g_new0(bool, len);
+    prog->frozen = g_new0(guint8, len);
+    for (long addr = 0; addr < len; addr++)
+        prog->insns[addr] = decode(prog->image, len, addr);
+
+    // the fallthrough of the unconditional jumps too: it's usually the return address of a call
+    GArray *pending = g_array_new(FALSE, FALSE, sizeof(long));
+    long start = 0;
+    g_array_append_val(pending, start);
+    while (pending->len > 0) {
+        long addr = g_array_index(pending, long, pending->len - 1);
+        g_array_set_size(pending, pending->len - 1);
+        if (addr < 0 || addr >= len || prog->reachable[addr])
+            continue;
+        prog->reachable[addr] = true;
+
+        const Insn *insn = &prog->insns[addr];
+        if (insn->op == 0 || insn->op == OP_HALT)
+            continue;
+        long next = addr + 1 + insn->n_args;
+        g_array_append_val(pending, next);
+        if (is_jump(insn->op) && insn->modes[1] == ARG_MODE_IMM)
+            g_array_append_val(pending, prog->image[addr + 2]);
+    }
+
+    // the computed jumps usually return there, and the computer resumes at its I/O
+    prog->entry[0] = true;
+    for (long addr = 0; addr < len; addr++) {
+        const Insn *insn = &prog->insns[addr];
+        if (!prog->reachable[addr])
+            continue;
+        if (insn->op == OP_READ || insn->op == OP_WRITE)
+            prog->entry[addr] = true;
+        if (is_jump(insn->op)) {
+            long target = prog->image[addr + 2];
+            if (insn->modes[1] == ARG_MODE_IMM && target >= 0 && target < len)
+                prog->entry[target] = true;
+            if (addr + 3 < len)
+                prog->entry[addr + 3] = true;
+        }
+    }
+    g_array_free(pending, TRUE);
+
+    for (long addr = 0; addr < len; addr++) {
+        const Insn *insn = &prog->insns[addr];
+        if (!prog->reachable[addr] || insn->op == 0)
+            continue;
+        int write_arg = is_arith(insn->op) ? 3 : insn->op == OP_READ ? 1 : 0;
+        if (write_arg != 0 && insn->modes[write_arg - 1] == ARG_MODE_POS) {
+            long target = prog->image[addr + write_arg];
+            if (target >= 0 && target < len)
+                prog->written[target] = true;
+        }
+    }
+
+    for (long addr = 0; addr < len; addr++) {
+        const Insn *insn = &prog->insns[addr];
+        if (!prog->reachable[addr] || insn->op == 0)
+            continue;
+        for (long cell = addr; cell <= addr + insn->n_args; cell++)
+            prog->frozen[cell] |= !prog->written[cell];
+    }
+}
+
+static void
+program_free(Program *prog) {
+    g_free(prog->insns);
+    g_free(prog->reachable);
+    g_free(prog->entry);
+    g_free(prog->written);
+    g_free(prog->frozen);
+}
+
+static char *
+literal(long val) {
+    if (val == LONG_MIN)
+        return g_strdup("(-9223372036854775807L - 1)");
+    return g_strdup_printf("%ldL", val);
+}
+
+/* The value of a cell of the instruction: constant if no instruction writes it */
+static char *
+cell_expr(const Program *prog, long cell) {
+    if (prog->written[cell])
+        return g_strdup_printf("D[%ld]", cell);
+    return literal(prog->image[cell]);
+}
+
+static char *
+arg_read(const Program *prog, long addr, int arg) {
+    long cell = addr + arg;
+    char *val = cell_expr(prog, cell);
+    char *expr;
+    switch (prog->insns[addr].modes[arg - 1]) {
+    case ARG_MODE_IMM:
+        return val;
+    case ARG_MODE_POS:
+        if (!prog->written[cell] && prog->image[cell] >= 0 && prog->image[cell] < prog->len)
+            expr = g_strdup_printf("D[%ld]", prog->image[cell]);
+        else
+            expr = g_strdup_printf("AOT_GET(%s)", val);
+        break;
+    default:
+        expr = g_strdup_printf("AOT_GET(rb + %s)", val);
+    }
+    g_free(val);
+    return expr;
+}
+
+static void
+emit_write(FILE *out, Program *prog, long addr, int arg, const char *val) {
+    long cell = addr + arg;
+    long next = addr + 1 + prog->insns[addr].n_args;
+    if (prog->insns[addr].modes[arg - 1] == ARG_MODE_POS && !prog->written[cell] &&
+        prog->image[cell] >= 0 && prog->image[cell] < prog->len) {
+        // a target of a fixed write is never frozen
+        fprintf(out, "    AOT_SET_STATIC(%ld, %s);\n", prog->image[cell], val);
+        return;
+    }
+
+    char *target = cell_expr(prog, cell);
+    if (prog->insns[addr].modes[arg - 1] == ARG_MODE_REL)
+        fprintf(out, "    AOT_SET(rb + %s, %s, %ld);\n", target, val, next);
+    else
+        fprintf(out, "    AOT_SET(%s, %s, %ld);\n", target, val, next);
+    g_free(target);
+    prog->uses_stale = true;
+}
+
+static void
+emit_goto(FILE *out, const Program *prog, long target) {
+    if (target >= 0 && target < prog->len && prog->reachable[target])
+        fprintf(out, "goto L%ld;", target);
+    else
+        fprintf(out, "{ ip = %ld; goto dispatch; }", target);
+}
+
+static void
+emit_insn(FILE *out, Program *prog, long addr) {
+    const Insn *insn = &prog->insns[addr];
+    long next = addr + 1 + insn->n_args;
+    fprintf(out, "L%ld:\n", addr);
+    if (insn->op == 0) {
+        fprintf(out, "    ip = %ld;\n    goto step;\n", addr);
+        return;
+    }
+    if (prog->written[addr])
+        fprintf(out, "    AOT_GUARD(%ld);\n", addr);
+    fprintf(out, "    n++;\n");
+
+    char *args[3] = {NULL};
+    for (int i = 0; i < insn->n_args; i++) {
+        bool write = (is_arith(insn->op) && i == 2) || insn->op == OP_READ;
+        if (!write)
+            args[i] = arg_read(prog, addr, i + 1);
+    }
+
+    static const char *const arith_ops[] = {[OP_ADD] = "+", [OP_MUL] = "*", [OP_LESS] = "<", [OP_EQUAL] = "=="};
+    switch (insn->op) {
+    case OP_ADD: case OP_MUL: case OP_LESS: case OP_EQUAL: {
+        char *val = g_strdup_printf("%s %s %s", args[0], arith_ops[insn->op], args[1]);
+        emit_write(out, prog, addr, 3, val);
+        g_free(val);
+        break;
+    }
+    case OP_JUMP_TRUE: case OP_JUMP_FALSE:
+        fprintf(out, "    if (%s %s 0) ", args[0], insn->op == OP_JUMP_TRUE ? "!=" : "==");
+        if (insn->modes[1] == ARG_MODE_IMM && !prog->written[addr + 2])
+            emit_goto(out, prog, prog->image[addr + 2]);
+        else
+            fprintf(out, "{ ip = %s; goto dispatch; }", args[1]);
+        fprintf(out, "\n");
+        break;
+    case OP_READ:
+        fprintf(out, "    if (!intcode_chan_pop(vm->input, &val)) {\n"
+                     "        ip = %ld;\n        *state = STATE_WAIT_INPUT;\n        goto out;\n    }\n", addr);
+        emit_write(out, prog, addr, 1, "val");
+        prog->uses_out = true;
+        break;
+    case OP_WRITE:
+        fprintf(out, "    if (!intcode_chan_push(vm->output, %s)) {\n"
+                     "        ip = %ld;\n        *state = STATE_WAIT_OUTPUT;\n        goto out;\n    }\n", args[0], addr);
+        prog->uses_out = true;
+        break;
+    case OP_MV_BASE:
+        fprintf(out, "    rb += %s;\n", args[0]);
+        break;
+    case OP_HALT:
+        fprintf(out, "    vm->halted = true;\n    ip = %ld;\n    *state = STATE_HALT;\n    goto out;\n", addr);
+        prog->uses_out = true;
+        break;
+    }
+    if (insn->op != OP_HALT) {
+        fprintf(out, "    ");
+        emit_goto(out, prog, next);
+        fprintf(out, "\n");
+    }
+
+    for (int i = 0; i < 3; i++)
+        g_free(args[i]);
+}
+
+static void
+emit_program(FILE *out, Program *prog, const char *source) {
+    fprintf(out, "/* Generated by intcode_aot from %s, don't edit */\n", source);
+    fprintf(out, "#include \"intcode_aot.h\"\n\n#define AOT_LEN %ld\n\n", prog->len);
+
+    fprintf(out, "static const long aot_image[AOT_LEN] = {");
+    for (long addr = 0; addr < prog->len; addr++) {
+        char *val = literal(prog->image[addr]);
+        fprintf(out, "%s%s", addr % 8 == 0 ? "\n    " : " ", val);
+        fprintf(out, addr + 1 < prog->len ? "," : "\n");
+        g_free(val);
+    }
+    fprintf(out, "};\n\nstatic const guint8 aot_frozen[AOT_LEN] = {");
+    for (long addr = 0; addr < prog->len; addr++)
+        fprintf(out, "%s%d%s", addr % 32 == 0 ? "\n    " : "", prog->frozen[addr], addr + 1 < prog->len ? "," : "\n");
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static bool\naot_run(Intcode *vm, IntcodeState *state) {\n"
+                 "    long ip = vm->ip, rb = vm->rel_base, val;\n"
+                 "    unsigned long n = 0;\n"
+                 "    long *restrict D;\n    size_t L;\n    IntcodeAotCode *C;\n"
+                 "    AOT_LOAD();\n    (void)val;\n    (void)L;\n    (void)C;\n\n");
+
+    fprintf(out, "dispatch:\n    switch (ip) {\n");
+    for (long addr = 0; addr < prog->len; addr++) {
+        if (prog->reachable[addr] && prog->entry[addr])
+            fprintf(out, "    case %ld: goto L%ld;\n", addr, addr);
+    }
+    fprintf(out, "    default: goto step;\n    }\n\n");
+
+    for (long addr = 0; addr < prog->len; addr++) {
+        if (prog->reachable[addr])
+            emit_insn(out, prog, addr);
+    }
+
+    fprintf(out, "\nstep:\n"
+                 "    AOT_SAVE();\n"
+                 "    if (!intcode_step(vm, state))\n        return true;\n"
+                 "    if (G_UNLIKELY(vm->compiled_stale))\n        return false;\n"
+                 "    ip = vm->ip;\n    rb = vm->rel_base;\n    AOT_LOAD();\n    goto dispatch;\n");
+    if (prog->uses_out)
+        fprintf(out, "\nout:\n    AOT_SAVE();\n    return true;\n");
+    if (prog->uses_stale)
+        fprintf(out, "\nstale:\n    AOT_SAVE();\n    return false;\n");
+    fprintf(out, "}\n\nconst IntcodeCompiled intcode_aot_program = {aot_image, aot_frozen, AOT_LEN, aot_run};\n");
+}
+
+int
+main(int argc, char **argv) {
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("IMAGE OUTPUT - Translate an Intcode program to C");
+    if (!g_option_context_parse(context, &argc, &argv, &error))
+        aoc_die("Option parsing failed: %s\n", error->message);
+    g_option_context_free(context);
+    if (argc != 3)
+        aoc_die("Usage: %s IMAGE OUTPUT\n", argv[0]);
+
+    char *data;
+    size_t len, err_offset;
+    if (!g_file_get_contents(argv[1], &data, &len, &error))
+        aoc_die("Can't read %s: %s\n", argv[1], error->message);
+    GArray *values = aoc_input_parse_num_list(data, len, ',', &err_offset);
+    if (values == NULL)
+        aoc_die("Parse number error at offset %zu\n", err_offset);
+    if (values->len == 0)
+        aoc_die("Empty program\n");
+
+    Program prog = {.image = (const long *)values->data, .len = values->len};
+    program_analyze(&prog);
+
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL)
+        aoc_die("Can't write %s\n", argv[2]);
+    char *source = g_path_get_basename(argv[1]);
+    emit_program(out, &prog, source);
+    if (fclose(out) != 0)
+        aoc_die("Can't write %s\n", argv[2]);
+
+    g_free(source);
+    program_free(&prog);
+    g_array_free(values, TRUE);
+    g_free(data);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,85 @@
+#ifndef INTCODE_AOT_H_
+#define INTCODE_AOT_H_
+
+#include "intcode.h"
+
+/*
+ * Intcode program translated to C by intcode_aot, for the image it was
+ * translated from. run continues the execution of the computer like
+ * intcode_run, and returns true with the state it stopped at. It returns
+ * false if it has to give up because the program wrote over a cell of the
+ * compiled code that it assumed constant (frozen): then the computer is left
+ * at the next instruction, and intcode_run interprets it from there.
+ */
+typedef bool (*IntcodeCompiledFn)(Intcode *self, IntcodeState *state);
+
+struct _IntcodeCompiled {
+    const long *image;
+    const guint8 *frozen;
+    size_t len;
+    IntcodeCompiledFn run;
+};
+
+/**
+ * The compiled program linked in the executable, if any. intcode_reset
+ * enables it for the computers whose program is its image.
+ */
+extern const IntcodeCompiled intcode_aot_program;
+
+/*
+ * The decode cache seen through a struct, so that invalidating it doesn't
+ * alias the cells of D, like a plain IntcodeInsn (a char) would.
+ */
+typedef struct {
+    IntcodeInsn insn;
+} IntcodeAotCode;
+
+/*
+ * Helpers of the generated code, that keeps in locals the computer (vm),
+ * its registers (ip, rb), the instructions executed (n) and its dense memory
+ * (D, L, C), reloaded after any call that can grow it.
+ */
+#define AOT_LOAD() (D = vm->mem.data, L = vm->mem.len, C = (IntcodeAotCode *)vm->mem.code)
+#define AOT_SAVE() (vm->ip = ip, vm->rel_base = rb, vm->insn_count += n, n = 0)
+
+static inline long
+intcode_aot_get(Intcode *vm, const long *D, size_t L, long addr) {
+    return G_LIKELY((size_t)addr < L) ? D[addr] : intcode_mem_get(vm, addr);
+}
+
+#define AOT_GET(addr) intcode_aot_get(vm, D, L, (addr))
+
+/* Write to a cell of the image that is never frozen */
+#define AOT_SET_STATIC(addr, val) (D[addr] = (val), C[addr].insn = 0)
+
+/*
+ * Write to any cell, and give up if it changes a frozen one. Growing the
+ * memory continues through the dispatch, so that the compiler can keep the
+ * cells in registers along the fast path.
+ */
+#define AOT_SET(addr, val, next) do { \
+        long a_ = (addr), v_ = (val); \
+        if (G_LIKELY((size_t)a_ < L)) { \
+            D[a_] = v_; \
+            C[a_].insn = 0; \
+            if (G_UNLIKELY((size_t)a_ < AOT_LEN && aot_frozen[a_] && v_ != aot_image[a_])) { \
+                ip = (next); \
+                goto stale; \
+            } \
+        } else { \
+            intcode_mem_set(vm, a_, v_); \
+            AOT_LOAD(); \
+            ip = (next); \
+            goto dispatch; \
+        } \
+    } while (0)
+
+/* The opcode at addr is written by the program: interpret it if it changed */
+#define AOT_GUARD(addr) do { \
+        if (G_UNLIKELY(D[addr] != aot_image[addr])) { \
+            ip = (addr); \
+            goto step; \
+        } \
+    } while (0)
+
+#endif // INTCODE_AOT_H_
@@ -0,0 +1,315 @@
+#include "intcode.h"
+#include "aoc_error.h"
+#include <limits.h>
+#include <string.h>
+
+#define W INTCODE_BATCH_WIDTH
+
+// ip of the lanes that have stopped, so they never are the next ones to run
+#define IP_STOPPED LONG_MAX
+
+// the block step is specialised for each opcode and argument modes, its
+// helpers must be inlined in all of them
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+static ALWAYS_INLINE long *
+cell(IntcodeBatch *self, long addr, size_t lane) {
+    return &self->mem[(size_t)addr * self->stride + lane];
+}
+
+static void
+lane_stop(IntcodeBatch *self, size_t lane, IntcodeState state) {
+    self->state[lane] = state;
+    self->stop_ip[lane] = self->ip[lane];
+    self->ip[lane] = IP_STOPPED;
+}
+
+/*
+ * Copy of the fields of the batch that the block step uses. The compiler
+ * can't keep them in registers otherwise: they could alias the memory cells.
+ */
+typedef struct {
+    long *mem;
+    size_t stride;
+    size_t len;
+    long *ip;
+    long *rel_base;
+    bool *dirty;
+} Lanes;
+
+/*
+ * Value of an argument for one lane, given the row of the memory with the
+ * argument of all the lanes. Clear ok if the lane reads a negative address.
+ */
+static ALWAYS_INLINE long
+lane_arg(const Lanes *l, const long *row, size_t lane, int mode, bool *ok) {
+    long addr = row[lane];
+    if (mode == ARG_MODE_IMM)
+        return addr;
+    if (mode == ARG_MODE_REL)
+        addr += l->rel_base[lane];
+    bool in_mem = (size_t)addr < l->len;
+    *ok &= addr >= 0;
+    long val = l->mem[(in_mem ? (size_t)addr : 0) * l->stride + lane];
+    return in_mem ? val : 0;
+}
+
+/* Address an argument writes to for one lane, clear ok if it's invalid */
+static ALWAYS_INLINE long
+lane_dst(const Lanes *l, const long *row, size_t lane, int mode, bool *ok) {
+    long addr = row[lane];
+    if (mode == ARG_MODE_REL)
+        addr += l->rel_base[lane];
+    bool in_mem = mode != ARG_MODE_IMM && (size_t)addr < l->len;
+    *ok &= in_mem;
+    return in_mem ? addr : 0;
+}
+
+/*
+ * Execute insn, at ip, in a block of W lanes starting at base, those that are
+ * at ip with that same instruction: lanes whose code was modified run theirs
+ * later.
+ */
+static ALWAYS_INLINE void
+block_step(IntcodeBatch *self, Lanes l, const long **rows, size_t base, long ip, long insn,
+           int op, int n_args, int mode1, int mode2, int mode3) {
+    const long *insns = l.mem + (size_t)ip * l.stride;
+
+    for (size_t lane = base; lane < base + W; lane++) {
+        if (l.ip[lane] != ip || insns[lane] != insn)
+            continue;
+
+        bool ok = true;
+        long a = lane_arg(&l, rows[0], lane, mode1, &ok);
+        long b = n_args > 1 ? lane_arg(&l, rows[1], lane, mode2, &ok) : 0;
+        long dst = n_args > 2 ? lane_dst(&l, rows[2], lane, mode3, &ok) : 0;
+        long res = 0;
+        switch (op) {
+        case OP_ADD: res = a + b; break;
+        case OP_MUL: res = a * b; break;
+        case OP_LESS: res = a < b; break;
+        case OP_EQUAL: res = a == b; break;
+        case OP_JUMP_TRUE: res = a != 0 ? b : ip + 3; break;
+        case OP_JUMP_FALSE: res = a == 0 ? b : ip + 3; break;
+        case OP_MV_BASE: res = l.rel_base[lane] + a; break;
+        }
+
+        if (!ok) {
+            lane_stop(self, lane, STATE_PROG_ERROR);
+        } else if (n_args == 3) {
+            l.mem[dst * l.stride + lane] = res;
+            l.dirty[dst] = true;
+            l.ip[lane] = ip + 4;
+        } else if (op == OP_MV_BASE) {
+            l.rel_base[lane] = res;
+            l.ip[lane] = ip + 2;
+        } else if (res >= 0) {
+            l.ip[lane] = res;
+        } else {
+            lane_stop(self, lane, STATE_PROG_ERROR);
+        }
+    }
+}
+
+#define BLOCK_STEP_MODES(mode1, mode2, mode3) \
+    for (size_t base = 0; base < l.stride; base += W) \
+        block_step(self, l, rows, base, ip, insn, op, n_args, mode1, mode2, mode3); \
+    break
+
+static ALWAYS_INLINE void
+op_step(IntcodeBatch *self, Lanes l, const long **rows, long ip, long insn, int op, int n_args) {
+    int mode1 = insn / 100 % 10, mode2 = insn / 1000 % 10, mode3 = insn / 10000 % 10;
+
+    // writes in immediate mode are rejected by insn_supported
+    switch (mode1 * 9 + mode2 * 3 + (mode3 == ARG_MODE_REL ? 2 : 0)) {
+    case 0:  BLOCK_STEP_MODES(ARG_MODE_POS, ARG_MODE_POS, ARG_MODE_POS);
+    case 2:  BLOCK_STEP_MODES(ARG_MODE_POS, ARG_MODE_POS, ARG_MODE_REL);
+    case 3:  BLOCK_STEP_MODES(ARG_MODE_POS, ARG_MODE_IMM, ARG_MODE_POS);
+    case 5:  BLOCK_STEP_MODES(ARG_MODE_POS, ARG_MODE_IMM, ARG_MODE_REL);
+    case 6:  BLOCK_STEP_MODES(ARG_MODE_POS, ARG_MODE_REL, ARG_MODE_POS);
+    case 8:  BLOCK_STEP_MODES(ARG_MODE_POS, ARG_MODE_REL, ARG_MODE_REL);
+    case 9:  BLOCK_STEP_MODES(ARG_MODE_IMM, ARG_MODE_POS, ARG_MODE_POS);
+    case 11: BLOCK_STEP_MODES(ARG_MODE_IMM, ARG_MODE_POS, ARG_MODE_REL);
+    case 12: BLOCK_STEP_MODES(ARG_MODE_IMM, ARG_MODE_IMM, ARG_MODE_POS);
+    case 14: BLOCK_STEP_MODES(ARG_MODE_IMM, ARG_MODE_IMM, ARG_MODE_REL);
+    case 15: BLOCK_STEP_MODES(ARG_MODE_IMM, ARG_MODE_REL, ARG_MODE_POS);
+    case 17: BLOCK_STEP_MODES(ARG_MODE_IMM, ARG_MODE_REL, ARG_MODE_REL);
+    case 18: BLOCK_STEP_MODES(ARG_MODE_REL, ARG_MODE_POS, ARG_MODE_POS);
+    case 20: BLOCK_STEP_MODES(ARG_MODE_REL, ARG_MODE_POS, ARG_MODE_REL);
+    case 21: BLOCK_STEP_MODES(ARG_MODE_REL, ARG_MODE_IMM, ARG_MODE_POS);
+    case 23: BLOCK_STEP_MODES(ARG_MODE_REL, ARG_MODE_IMM, ARG_MODE_REL);
+    case 24: BLOCK_STEP_MODES(ARG_MODE_REL, ARG_MODE_REL, ARG_MODE_POS);
+    case 26: BLOCK_STEP_MODES(ARG_MODE_REL, ARG_MODE_REL, ARG_MODE_REL);
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * Execute insn, at ip, in all the lanes that are at ip with that instruction.
+ * The loop over the lanes is specialised for each opcode and combination of
+ * argument modes, so it only has the loads and the operation of the lanes.
+ */
+static void
+group_step(IntcodeBatch *self, long ip, long insn) {
+    Lanes l = {
+        .mem = self->mem,
+        .stride = self->stride,
+        .len = self->len,
+        .ip = self->ip,
+        .rel_base = self->rel_base,
+        .dirty = self->dirty,
+    };
+
+    // rows with the arguments of all the lanes, or zeros beyond the memory
+    long *zeros = NULL;
+    const long *rows[3];
+    for (int n = 0; n < 3; n++) {
+        if ((size_t)(ip + n + 1) < l.len) {
+            rows[n] = l.mem + (size_t)(ip + n + 1) * l.stride;
+        } else {
+            if (zeros == NULL)
+                zeros = g_new0(long, l.stride);
+            rows[n] = zeros;
+        }
+    }
+
+    switch (insn % 100) {
+    case OP_ADD:        op_step(self, l, rows, ip, insn, OP_ADD, 3); break;
+    case OP_MUL:        op_step(self, l, rows, ip, insn, OP_MUL, 3); break;
+    case OP_LESS:       op_step(self, l, rows, ip, insn, OP_LESS, 3); break;
+    case OP_EQUAL:      op_step(self, l, rows, ip, insn, OP_EQUAL, 3); break;
+    case OP_JUMP_TRUE:  op_step(self, l, rows, ip, insn, OP_JUMP_TRUE, 2); break;
+    case OP_JUMP_FALSE: op_step(self, l, rows, ip, insn, OP_JUMP_FALSE, 2); break;
+    case OP_MV_BASE:    op_step(self, l, rows, ip, insn, OP_MV_BASE, 1); break;
+    default:
+        g_assert_not_reached();
+    }
+
+    g_free(zeros);
+}
+
+static bool
+insn_supported(long insn) {
+    int modes[3] = {insn / 100 % 10, insn / 1000 % 10, insn / 10000 % 10};
+    for (int i = 0; i < 3; i++) {
+        if (modes[i] > ARG_MODE_REL)
+            return false;
+    }
+
+    switch (insn % 100) {
+    case OP_ADD: case OP_MUL: case OP_LESS: case OP_EQUAL:
+        return insn < 100000 && modes[2] != ARG_MODE_IMM;
+    case OP_JUMP_TRUE: case OP_JUMP_FALSE: case OP_MV_BASE:
+        return insn < 100000;
+    default:
+        return false;
+    }
+}
+
+void
+intcode_batch_run(IntcodeBatch *self) {
+    while (true) {
+        // run the lanes that are behind: lanes that took a different branch
+        // wait, and join the others again when their instruction pointers meet
+        long ip = IP_STOPPED;
+        size_t first = 0;
+        for (size_t lane = 0; lane < self->stride; lane++) {
+            if (self->ip[lane] < ip) {
+                ip = self->ip[lane];
+                first = lane;
+            }
+        }
+        if (ip == IP_STOPPED)
+            break;
+
+        if ((size_t)ip >= self->len) {
+            for (size_t lane = 0; lane < self->stride; lane++) {
+                if (self->ip[lane] == ip)
+                    lane_stop(self, lane, STATE_PROG_ERROR);
+            }
+            continue;
+        }
+
+        long insn = *cell(self, ip, first);
+        if (insn == OP_HALT || !insn_supported(insn)) {
+            IntcodeState state = insn == OP_HALT ? STATE_HALT : STATE_PROG_ERROR;
+            for (size_t lane = 0; lane < self->stride; lane++) {
+                if (self->ip[lane] == ip && *cell(self, ip, lane) == insn)
+                    lane_stop(self, lane, state);
+            }
+            continue;
+        }
+
+        group_step(self, ip, insn);
+    }
+}
+
+void
+intcode_batch_init(IntcodeBatch *self, const GArray *prog, size_t n_lanes) {
+    self->image = g_array_ref((GArray *)prog);
+    self->n_lanes = n_lanes;
+    self->stride = (n_lanes + W - 1) / W * W;
+    self->len = MAX(prog->len, 1u);
+    self->mem = g_new(long, self->len * self->stride);
+    self->ip = g_new(long, self->stride);
+    self->stop_ip = g_new(long, self->stride);
+    self->rel_base = g_new(long, self->stride);
+    self->state = g_new(IntcodeState, self->stride);
+    self->dirty = g_new(bool, self->len);
+    memset(self->dirty, true, self->len * sizeof(bool));
+    intcode_batch_reset(self);
+}
+
+void
+intcode_batch_reset(IntcodeBatch *self) {
+    for (size_t addr = 0; addr < self->len; addr++) {
+        if (!self->dirty[addr])
+            continue;
+        self->dirty[addr] = false;
+        long val = addr < self->image->len ? g_array_index(self->image, long, addr) : 0;
+        long *row = cell(self, addr, 0);
+        for (size_t lane = 0; lane < self->stride; lane++)
+            row[lane] = val;
+    }
+
+    for (size_t lane = 0; lane < self->stride; lane++) {
+        self->rel_base[lane] = 0;
+        self->stop_ip[lane] = 0;
+        self->state[lane] = STATE_HALT;
+        // padding lanes never run
+        self->ip[lane] = lane < self->n_lanes ? 0 : IP_STOPPED;
+    }
+}
+
+void
+intcode_batch_deinit(IntcodeBatch *self) {
+    g_free(self->mem);
+    g_free(self->ip);
+    g_free(self->stop_ip);
+    g_free(self->rel_base);
+    g_free(self->state);
+    g_free(self->dirty);
+    g_array_unref(self->image);
+}
+
+long
+intcode_batch_mem_get(IntcodeBatch *self, size_t lane, long addr) {
+    g_assert(lane < self->n_lanes);
+    if (addr < 0 || (size_t)addr >= self->len)
+        return 0;
+    return *cell(self, addr, lane);
+}
+
+void
+intcode_batch_mem_set(IntcodeBatch *self, size_t lane, long addr, long val) {
+    g_assert(lane < self->n_lanes);
+    if (addr < 0 || (size_t)addr >= self->len)
+        aoc_die("Intcode batch: write out of the memory at %ld\n", addr);
+    *cell(self, addr, lane) = val;
+    self->dirty[addr] = true;
+}
@@ -0,0 +1,62 @@
+#include "aoc_input.h"
+#include "aoc_error.h"
+#include "intcode.h"
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_MIN_TIME (2 * G_USEC_PER_SEC)
+#define BOOST_SENSOR_MODE 2
+
+static GArray *
+parse_input() {
+    AocInputReader *reader = aoc_input_reader_new_mapped("day09");
+    if (reader == NULL)
+        return NULL;
+
+    size_t len, err_offset;
+    const char *data = aoc_input_reader_get_data(reader, &len);
+    GArray *values = aoc_input_parse_num_list(data, len, ',', &err_offset);
+    if (values == NULL)
+        aoc_die("Parse number error at offset %zu\n", err_offset);
+
+    g_object_unref(reader);
+    return values;
+}
+
+int
+main(int argc, char **argv) {
+    GArray *prog = parse_input();
+    if (prog == NULL)
+        aoc_die("Error parsing the input\n");
+
+    unsigned long runs = 0;
+    unsigned long insns = 0;
+    const char *native = "";
+    gint64 start = g_get_monotonic_time();
+    gint64 elapsed;
+
+    do {
+        Intcode computer;
+        intcode_init(&computer, prog);
+        intcode_input_push(&computer, BOOST_SENSOR_MODE);
+        if (intcode_run(&computer) != STATE_HALT)
+            aoc_die("Unexpected program exit status\n");
+
+        insns += computer.insn_count;
+        if (computer.jit != NULL)
+            native = " (jit)";
+        else if (computer.compiled != NULL)
+            native = " (compiled)";
+        intcode_deinit(&computer);
+        runs++;
+        elapsed = g_get_monotonic_time() - start;
+    } while (elapsed < BENCH_MIN_TIME);
+
+    double secs = (double)elapsed / G_USEC_PER_SEC;
+    printf("intcode %s dispatch%s: %lu runs, %lu instructions in %.3f s = %.1f Minsn/s\n",
+           intcode_dispatch_name(), native, runs, insns, secs, insns / secs / 1e6);
+
+    g_array_free(prog, TRUE);
+    return EXIT_SUCCESS;
+}
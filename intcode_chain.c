@@ -0,0 +1,190 @@
+#include "intcode.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+
+typedef struct _IntcodeChain IntcodeChain;
+
+struct _IntcodeWaiter {
+    IntcodeChain *chain;
+    Intcode *computer;
+    GThread *thread;
+    GCond cond;
+    atomic_bool waiting;
+    IntcodeChan *wait_chan;
+    bool wait_read;
+    bool done;
+    IntcodeState state;
+};
+
+struct _IntcodeChain {
+    GMutex lock;
+    IntcodeWaiter *waiters;
+    size_t n;
+    bool stuck;
+};
+
+void
+intcode_waiter_wake(IntcodeWaiter *waiter) {
+    // pairs with the store of waiting in waiter_block: either the waiter
+    // sees the channel change or we see it waiting
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(&waiter->waiting, memory_order_relaxed))
+        return;
+
+    g_mutex_lock(&waiter->chain->lock);
+    g_cond_signal(&waiter->cond);
+    g_mutex_unlock(&waiter->chain->lock);
+}
+
+static bool
+waiter_can_run(IntcodeWaiter *waiter) {
+    if (waiter->done)
+        return false;
+    if (!atomic_load(&waiter->waiting))
+        return true;
+
+    IntcodeChan *chan = waiter->wait_chan;
+    if (waiter->wait_read)
+        return intcode_chan_len(chan) > 0;
+    return intcode_chan_len(chan) <= chan->mask;
+}
+
+/* Called with the lock held: if nobody can run, wake everybody to give up */
+static void
+chain_check_stuck(IntcodeChain *chain) {
+    bool all_done = true;
+    for (size_t i = 0; i < chain->n; i++) {
+        if (waiter_can_run(&chain->waiters[i]))
+            return;
+        all_done = all_done && chain->waiters[i].done;
+    }
+
+    if (all_done)
+        return;
+
+    chain->stuck = true;
+    for (size_t i = 0; i < chain->n; i++)
+        g_cond_signal(&chain->waiters[i].cond);
+}
+
+/* Block until the channel is readable/writable. Return false if stuck. */
+static bool
+waiter_block(IntcodeWaiter *self, IntcodeChan *chan, bool read) {
+    IntcodeChain *chain = self->chain;
+    g_mutex_lock(&chain->lock);
+
+    self->wait_chan = chan;
+    self->wait_read = read;
+    atomic_store(&self->waiting, true);
+
+    while (!chain->stuck && !waiter_can_run(self)) {
+        chain_check_stuck(chain);
+        if (!chain->stuck)
+            g_cond_wait(&self->cond, &chain->lock);
+    }
+
+    atomic_store(&self->waiting, false);
+    bool ok = !chain->stuck;
+    g_mutex_unlock(&chain->lock);
+    return ok;
+}
+
+static gpointer
+waiter_run(gpointer data) {
+    IntcodeWaiter *self = data;
+    Intcode *computer = self->computer;
+
+    IntcodeState rc;
+    while (true) {
+        rc = intcode_run(computer);
+        if (rc == STATE_WAIT_INPUT && waiter_block(self, computer->input, true))
+            continue;
+        if (rc == STATE_WAIT_OUTPUT && waiter_block(self, computer->output, false))
+            continue;
+        break;
+    }
+
+    g_mutex_lock(&self->chain->lock);
+    self->state = rc;
+    self->done = true;
+    chain_check_stuck(self->chain);
+    g_mutex_unlock(&self->chain->lock);
+    return NULL;
+}
+
+static IntcodeState
+run_threaded(Intcode *computers, size_t n) {
+    IntcodeChain chain = {.n = n, .stuck = false};
+    g_mutex_init(&chain.lock);
+    chain.waiters = g_new0(IntcodeWaiter, n);
+
+    for (size_t i = 0; i < n; i++) {
+        IntcodeWaiter *waiter = &chain.waiters[i];
+        waiter->chain = &chain;
+        waiter->computer = &computers[i];
+        g_cond_init(&waiter->cond);
+        atomic_init(&waiter->waiting, false);
+        computers[i].input->reader = waiter;
+        computers[i].output->writer = waiter;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        chain.waiters[i].thread = g_thread_new("intcode", waiter_run, &chain.waiters[i]);
+
+    IntcodeState state = STATE_HALT;
+    for (size_t i = 0; i < n; i++) {
+        IntcodeWaiter *waiter = &chain.waiters[i];
+        g_thread_join(waiter->thread);
+        if (waiter->state == STATE_PROG_ERROR || (state == STATE_HALT && waiter->state != STATE_HALT))
+            state = waiter->state;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        computers[i].input->reader = NULL;
+        computers[i].output->writer = NULL;
+        g_cond_clear(&chain.waiters[i].cond);
+    }
+    g_free(chain.waiters);
+    g_mutex_clear(&chain.lock);
+    return state;
+}
+
+static IntcodeState
+run_cooperative(Intcode *computers, size_t n) {
+    while (true) {
+        bool all_halted = true;
+        bool progress = false;
+        IntcodeState blocked = STATE_HALT;
+
+        for (size_t i = 0; i < n; i++) {
+            if (computers[i].halted)
+                continue;
+
+            // a computer resumed while still blocked only counts the retried
+            // read/write instruction
+            unsigned long insn_count = computers[i].insn_count;
+            IntcodeState rc = intcode_run(&computers[i]);
+            if (rc == STATE_PROG_ERROR)
+                return rc;
+
+            if (rc != STATE_HALT) {
+                all_halted = false;
+                blocked = rc;
+            }
+            if (rc == STATE_HALT || computers[i].insn_count - insn_count > 1)
+                progress = true;
+        }
+
+        if (all_halted)
+            return STATE_HALT;
+        if (!progress)
+            return blocked;
+    }
+}
+
+IntcodeState
+intcode_run_all(Intcode *computers, size_t n, IntcodeSched sched) {
+    if (sched == INTCODE_SCHED_THREADED)
+        return run_threaded(computers, n);
+    return run_cooperative(computers, n);
+}
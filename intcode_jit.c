@@ -0,0 +1,806 @@
+#include "intcode_jit.h"
+#include "aoc_error.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+
+/*
+ * Basic block JIT for x86-64. The computer runs through a dispatch loop that
+ * calls the compiled block starting at ip, or interprets one instruction
+ * with intcode_step. Each address the loop interprets gets hotter, and when
+ * it reaches INTCODE_JIT_HOT the block starting there is compiled: the
+ * instructions that follow it, through the conditional jumps, until an
+ * unconditional one or an instruction that needs the interpreter (I/O, halt,
+ * invalid). A jump back to the start of the block stays in native code, and
+ * so does a jump to another compiled block: constant targets are linked
+ * directly, computed ones are looked up in the entries. Other jumps, and
+ * anything the native code can't do (memory accesses out of the dense
+ * memory), return to the loop.
+ * The cells of the instructions are compiled as constants (covered). Writes
+ * to them, from native code or not, drop all the compiled code and mark the
+ * cell as dynamic: from then on it's read at run time, and if it's an opcode,
+ * checked before running its instruction.
+ */
+
+/* Instructions of a block at most */
+#define JIT_BLOCK_MAX 64
+/* Size of the executable memory of each computer, flushed when it's full */
+#define JIT_CODE_SIZE (1ul << 20)
+/* Heat of the addresses where no block can start */
+#define JIT_NEVER UINT32_MAX
+
+/* Why the native code returned, in the ip of the frame */
+typedef enum {
+    JIT_EXIT_NEXT,      // continue at ip
+    JIT_EXIT_STEP,      // interpret the instruction at ip
+    JIT_EXIT_WRITE,     // wrote the covered cell written, continue at ip
+    JIT_EXIT_LOOP       // not an exit: jump back to the start of the block
+} JitExit;
+
+/* State shared with the native code, which keeps it in registers */
+typedef struct {
+    long *data;
+    IntcodeInsn *code;
+    guint8 *covered;
+    size_t len;
+    long ip;
+    long rel_base;
+    unsigned long insn_count;
+    long written;
+    const void *entries;        // JitEntry, of the IntcodeJit
+    size_t entries_len;
+} JitFrame;
+
+typedef JitExit (*JitFn)(JitFrame *frame);
+
+typedef struct {
+    JitFn fn;
+    guint32 heat;
+} JitEntry;
+
+// the native code finds entries[ip] with a shift
+G_STATIC_ASSERT(sizeof(JitEntry) == 16);
+
+/* Exit of a block to a constant address, in the compiler (pos) and once placed (rel32) */
+typedef struct {
+    long target;
+    size_t pos;
+    guint8 *rel32;
+} JitLink;
+
+struct _IntcodeJit {
+    size_t len;         // cells of entries, covered and dynamic
+    JitEntry *entries;  // by the address where the block starts
+    guint8 *covered;
+    guint8 *dynamic;
+    guint8 *code;
+    size_t code_used;
+    size_t body;        // offset of the instructions in the code of the blocks
+    GArray *links;      // exits waiting for the block of their target
+};
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/* Registers of the native code. RSP as an index means no index. */
+#define REG_DATA RBX
+#define REG_CODE RBP
+#define REG_RB R12
+#define REG_FRAME R13
+#define REG_LEN R14
+#define REG_COVERED R15
+#define NO_INDEX RSP
+
+#define FRAME(field) ((gint32)offsetof(JitFrame, field))
+
+/* Registers that keep the cells read or written by the block, until they can change */
+static const int cache_regs[] = {RSI, RDI, R8, R9, R10, R11};
+#define JIT_CACHE_SIZE G_N_ELEMENTS(cache_regs)
+
+/* A cell at a constant address (ARG_MODE_POS), or relative to the base (ARG_MODE_REL) */
+typedef struct {
+    bool valid;
+    int mode;
+    long addr;
+} JitCached;
+
+/* Exit of a block, emitted after the code of its instructions */
+typedef struct {
+    size_t patch;       // rel32 of the jump to the stub
+    JitExit exit;
+    long ip;
+    bool ip_in_rcx;     // computed jump
+    unsigned count;     // instructions completed in the block
+} JitStub;
+
+typedef struct {
+    IntcodeJit *jit;
+    const long *data;
+    size_t len;
+    long start;
+    long ip;            // instruction being compiled
+    unsigned count;     // instructions before it in the block
+    GByteArray *buf;
+    GArray *stubs;
+    GArray *covered;
+    GArray *links;
+    size_t body;        // where the jumps back to the start go
+    JitCached cache[JIT_CACHE_SIZE];
+    size_t cache_next;  // slot to replace
+} JitCompiler;
+
+typedef struct {
+    int op;             // IntcodeOp, or 0 if the native code can't run it
+    int n_args;
+    int modes[3];
+} JitInsn;
+
+static void
+emit8(JitCompiler *c, guint8 byte) {
+    g_byte_array_append(c->buf, &byte, 1);
+}
+
+static void
+emit32(JitCompiler *c, gint32 val) {
+    g_byte_array_append(c->buf, (const guint8 *)&val, sizeof(val));
+}
+
+static void
+emit64(JitCompiler *c, gint64 val) {
+    g_byte_array_append(c->buf, (const guint8 *)&val, sizeof(val));
+}
+
+/* Opcodes of 2 bytes have 0x0f first */
+static void
+emit_op(JitCompiler *c, guint16 op) {
+    if (op > 0xff)
+        emit8(c, op >> 8);
+    emit8(c, op & 0xff);
+}
+
+static void
+emit_rex(JitCompiler *c, bool wide, int reg, int index, int base) {
+    guint8 rex = (wide ? 8 : 0) | (reg & 8 ? 4 : 0) | (index & 8 ? 2 : 0) | (base & 8 ? 1 : 0);
+    if (rex != 0)
+        emit8(c, 0x40 | rex);
+}
+
+/* op reg, [base + index << scale + disp], always with a 32 bits displacement */
+static void
+emit_mem(JitCompiler *c, bool wide, guint16 op, int reg, int base, int index, int scale, gint32 disp) {
+    emit_rex(c, wide, reg, index, base);
+    emit_op(c, op);
+    if (index != NO_INDEX || (base & 7) == RSP) {
+        emit8(c, 0x80 | (reg & 7) << 3 | 4);
+        emit8(c, scale << 6 | (index & 7) << 3 | (base & 7));
+    } else {
+        emit8(c, 0x80 | (reg & 7) << 3 | (base & 7));
+    }
+    emit32(c, disp);
+}
+
+/* op rm, reg with 64 bits registers */
+static void
+emit_rr(JitCompiler *c, guint16 op, int reg, int rm) {
+    emit_rex(c, true, reg, NO_INDEX, rm);
+    emit_op(c, op);
+    emit8(c, 0xc0 | (reg & 7) << 3 | (rm & 7));
+}
+
+static void
+emit_mov_imm(JitCompiler *c, int reg, long val) {
+    emit_rex(c, true, 0, NO_INDEX, reg);
+    if (val == (gint32)val) {
+        emit8(c, 0xc7);
+        emit8(c, 0xc0 | (reg & 7));
+        emit32(c, val);
+    } else {
+        emit8(c, 0xb8 | (reg & 7));
+        emit64(c, val);
+    }
+}
+
+static void
+patch32(JitCompiler *c, size_t pos, size_t target) {
+    gint32 rel = (gint64)target - (gint64)(pos + 4);
+    memcpy(c->buf->data + pos, &rel, sizeof(rel));
+}
+
+/* Jump (0xe9) or conditional jump (0x0f8x) to a new stub */
+static void
+emit_exit(JitCompiler *c, guint16 jump, JitExit exit, long ip, bool ip_in_rcx, unsigned count) {
+    emit_op(c, jump);
+    JitStub stub = {c->buf->len, exit, ip, ip_in_rcx, count};
+    emit32(c, 0);
+    g_array_append_val(c->stubs, stub);
+}
+
+static void
+emit_prologue(JitCompiler *c) {
+    static const guint8 push[] = {0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57};
+    g_byte_array_append(c->buf, push, sizeof(push));
+    emit_rr(c, 0x89, RDI, REG_FRAME);
+    emit_mem(c, true, 0x8b, REG_DATA, REG_FRAME, NO_INDEX, 0, FRAME(data));
+    emit_mem(c, true, 0x8b, REG_CODE, REG_FRAME, NO_INDEX, 0, FRAME(code));
+    emit_mem(c, true, 0x8b, REG_COVERED, REG_FRAME, NO_INDEX, 0, FRAME(covered));
+    emit_mem(c, true, 0x8b, REG_LEN, REG_FRAME, NO_INDEX, 0, FRAME(len));
+    emit_mem(c, true, 0x8b, REG_RB, REG_FRAME, NO_INDEX, 0, FRAME(rel_base));
+    c->body = c->buf->len;
+}
+
+/* Jump to a new rel32, that goes to target (a position of the block) */
+static size_t
+emit_jmp(JitCompiler *c, guint16 jump, size_t target) {
+    emit_op(c, jump);
+    size_t pos = c->buf->len;
+    emit32(c, 0);
+    patch32(c, pos, target);
+    return pos;
+}
+
+/*
+ * The stubs of the exits, after the instructions. The exits to a constant
+ * address are linked (see jit_place) to its block, when it's compiled. The
+ * exits to a computed address look it up in the entries.
+ */
+static void
+emit_stubs_and_epilogue(JitCompiler *c) {
+    GArray *to_epilogue = g_array_new(FALSE, FALSE, sizeof(size_t));
+    size_t exit_next = c->buf->len;
+    emit8(c, 0xb8);     // mov eax, JIT_EXIT_NEXT
+    emit32(c, JIT_EXIT_NEXT);
+    size_t patch = emit_jmp(c, 0xe9, 0);
+    g_array_append_val(to_epilogue, patch);
+
+    for (size_t i = 0; i < c->stubs->len; i++) {
+        const JitStub *stub = &g_array_index(c->stubs, JitStub, i);
+        patch32(c, stub->patch, c->buf->len);
+        if (stub->count > 0) {
+            emit_mem(c, true, 0x81, 0, REG_FRAME, NO_INDEX, 0, FRAME(insn_count));
+            emit32(c, stub->count);
+        }
+        if (stub->exit == JIT_EXIT_LOOP) {
+            emit_jmp(c, 0xe9, c->body);
+            continue;
+        }
+
+        if (stub->ip_in_rcx) {
+            emit_mem(c, true, 0x89, RCX, REG_FRAME, NO_INDEX, 0, FRAME(ip));
+        } else if (stub->ip == (gint32)stub->ip) {
+            emit_mem(c, true, 0xc7, 0, REG_FRAME, NO_INDEX, 0, FRAME(ip));
+            emit32(c, stub->ip);
+        } else {
+            emit_mov_imm(c, RAX, stub->ip);
+            emit_mem(c, true, 0x89, RAX, REG_FRAME, NO_INDEX, 0, FRAME(ip));
+        }
+
+        if (stub->exit == JIT_EXIT_NEXT && stub->ip_in_rcx) {
+            // rax = entries[rcx].fn, if rcx is within the entries
+            emit_mem(c, true, 0x3b, RCX, REG_FRAME, NO_INDEX, 0, FRAME(entries_len));
+            emit_jmp(c, 0x0f83, exit_next);
+            emit_rr(c, 0x89, RCX, RAX);
+            static const guint8 shl_rax_4[] = {0x48, 0xc1, 0xe0, 0x04};
+            g_byte_array_append(c->buf, shl_rax_4, sizeof(shl_rax_4));
+            emit_mem(c, true, 0x03, RAX, REG_FRAME, NO_INDEX, 0, FRAME(entries));
+            emit_mem(c, true, 0x8b, RAX, RAX, NO_INDEX, 0, offsetof(JitEntry, fn));
+            emit_rr(c, 0x85, RAX, RAX);
+            emit_jmp(c, 0x0f84, exit_next);
+            emit8(c, 0x48);     // add rax, body
+            emit8(c, 0x05);
+            emit32(c, c->body);
+            emit8(c, 0xff);     // jmp rax
+            emit8(c, 0xe0);
+            continue;
+        }
+        if (stub->exit == JIT_EXIT_NEXT) {
+            JitLink link = {.target = stub->ip, .pos = emit_jmp(c, 0xe9, exit_next)};
+            g_array_append_val(c->links, link);
+            continue;
+        }
+
+        if (stub->exit == JIT_EXIT_WRITE)
+            emit_mem(c, true, 0x89, RDX, REG_FRAME, NO_INDEX, 0, FRAME(written));
+        emit8(c, 0xb8);     // mov eax, exit
+        emit32(c, stub->exit);
+        patch = emit_jmp(c, 0xe9, 0);
+        g_array_append_val(to_epilogue, patch);
+    }
+
+    for (size_t i = 0; i < to_epilogue->len; i++)
+        patch32(c, g_array_index(to_epilogue, size_t, i), c->buf->len);
+    emit_mem(c, true, 0x89, REG_RB, REG_FRAME, NO_INDEX, 0, FRAME(rel_base));
+    static const guint8 pop[] = {0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b, 0xc3};
+    g_byte_array_append(c->buf, pop, sizeof(pop));
+    g_array_free(to_epilogue, TRUE);
+}
+
+static int
+cache_find(JitCompiler *c, int mode, long addr) {
+    for (size_t i = 0; i < JIT_CACHE_SIZE; i++) {
+        if (c->cache[i].valid && c->cache[i].mode == mode && c->cache[i].addr == addr)
+            return cache_regs[i];
+    }
+    return -1;
+}
+
+/* Keep in the cache the value of the cell, that is in reg */
+static void
+cache_put(JitCompiler *c, int mode, long addr, int reg) {
+    size_t slot = c->cache_next;
+    for (size_t i = 0; i < JIT_CACHE_SIZE; i++) {
+        if (c->cache[i].valid && c->cache[i].mode == mode && c->cache[i].addr == addr)
+            slot = i;
+    }
+    if (slot == c->cache_next)
+        c->cache_next = (c->cache_next + 1) % JIT_CACHE_SIZE;
+    c->cache[slot] = (JitCached){true, mode, addr};
+    emit_rr(c, 0x89, reg, cache_regs[slot]);
+}
+
+/* Forget the cells that a write to a cell of the other mode could change */
+static void
+cache_forget_mode(JitCompiler *c, int mode) {
+    for (size_t i = 0; i < JIT_CACHE_SIZE; i++) {
+        if (c->cache[i].mode == mode)
+            c->cache[i].valid = false;
+    }
+}
+
+static void
+cache_clear(JitCompiler *c) {
+    for (size_t i = 0; i < JIT_CACHE_SIZE; i++)
+        c->cache[i].valid = false;
+}
+
+/* The value of a cell of the instruction: constant, unless the program rewrites it */
+static void
+emit_cell(JitCompiler *c, int reg, long cell) {
+    if (c->jit->dynamic[cell]) {
+        emit_mem(c, true, 0x8b, reg, REG_DATA, NO_INDEX, 0, cell * 8);
+    } else {
+        emit_mov_imm(c, reg, c->data[cell]);
+        g_array_append_val(c->covered, cell);
+    }
+}
+
+/*
+ * The address of the argument in the cell: return it if it's constant and
+ * within the memory, or compute it in RDX, leaving the block if it's out
+ */
+static long
+emit_addr(JitCompiler *c, long cell, int mode) {
+    long val = c->data[cell];
+    if (c->jit->dynamic[cell]) {
+        emit_mem(c, true, 0x8b, RDX, REG_DATA, NO_INDEX, 0, cell * 8);
+        if (mode == ARG_MODE_REL)
+            emit_rr(c, 0x01, REG_RB, RDX);
+    } else {
+        g_array_append_val(c->covered, cell);
+        if (mode == ARG_MODE_POS && val >= 0 && (size_t)val < c->len)
+            return val;
+        if (mode == ARG_MODE_REL && val == (gint32)val) {
+            emit_mem(c, true, 0x8d, RDX, REG_RB, NO_INDEX, 0, val);
+        } else {
+            emit_mov_imm(c, RDX, val);
+            if (mode == ARG_MODE_REL)
+                emit_rr(c, 0x01, REG_RB, RDX);
+        }
+    }
+    emit_rr(c, 0x39, REG_LEN, RDX);
+    emit_exit(c, 0x0f83, JIT_EXIT_STEP, c->ip, false, c->count);
+    return -1;
+}
+
+/* Whether the address of the argument is constant (or constant relative to the base) */
+static bool
+static_addr(JitCompiler *c, long cell, int mode) {
+    long val = c->data[cell];
+    if (c->jit->dynamic[cell])
+        return false;
+    return mode == ARG_MODE_REL || (val >= 0 && (size_t)val < c->len);
+}
+
+static void
+emit_read(JitCompiler *c, int reg, const JitInsn *insn, int arg) {
+    long cell = c->ip + arg;
+    int mode = insn->modes[arg - 1];
+    if (mode == ARG_MODE_IMM) {
+        emit_cell(c, reg, cell);
+        return;
+    }
+
+    bool cacheable = static_addr(c, cell, mode);
+    int cached = cacheable ? cache_find(c, mode, c->data[cell]) : -1;
+    if (cached >= 0) {
+        g_array_append_val(c->covered, cell);
+        emit_rr(c, 0x89, cached, reg);
+        return;
+    }
+    long addr = emit_addr(c, cell, mode);
+    if (addr >= 0)
+        emit_mem(c, true, 0x8b, reg, REG_DATA, NO_INDEX, 0, addr * 8);
+    else
+        emit_mem(c, true, 0x8b, reg, REG_DATA, RDX, 3, 0);
+    if (cacheable)
+        cache_put(c, mode, c->data[cell], reg);
+}
+
+/* Write RAX, resetting its decoded instruction, and leave the block if it's covered */
+static void
+emit_write(JitCompiler *c, const JitInsn *insn, int arg) {
+    long cell = c->ip + arg;
+    int mode = insn->modes[arg - 1];
+    bool cacheable = static_addr(c, cell, mode);
+    long addr = emit_addr(c, cell, mode);
+    if (addr >= 0)
+        emit_mov_imm(c, RDX, addr);
+    emit_mem(c, true, 0x89, RAX, REG_DATA, RDX, 3, 0);
+    emit_mem(c, false, 0xc6, 0, REG_CODE, RDX, 0, 0);
+    emit8(c, 0);
+    emit_mem(c, false, 0x80, 7, REG_COVERED, RDX, 0, 0);
+    emit8(c, 0);
+    emit_exit(c, 0x0f85, JIT_EXIT_WRITE, c->ip + 1 + insn->n_args, false, c->count + 1);
+
+    if (cacheable) {
+        cache_forget_mode(c, mode == ARG_MODE_POS ? ARG_MODE_REL : ARG_MODE_POS);
+        cache_put(c, mode, c->data[cell], RAX);
+    } else {
+        cache_clear(c);
+    }
+}
+
+/* Jump (unconditional or not) to the target, or to the ip in RCX */
+static void
+emit_jump(JitCompiler *c, guint16 jump, bool static_target, long target) {
+    if (static_target && target == c->start)
+        emit_exit(c, jump, JIT_EXIT_LOOP, 0, false, c->count + 1);
+    else
+        emit_exit(c, jump, JIT_EXIT_NEXT, target, !static_target, c->count + 1);
+}
+
+static JitInsn
+decode(const long *data, size_t len, long addr) {
+    JitInsn insn = {0};
+    long val = data[addr];
+    if (val < 0 || val >= 100000)
+        return insn;
+
+    int write_arg = 0;
+    switch (val % 100) {
+    case OP_ADD: case OP_MUL: case OP_LESS: case OP_EQUAL:
+        insn.n_args = 3;
+        write_arg = 3;
+        break;
+    case OP_JUMP_TRUE: case OP_JUMP_FALSE:
+        insn.n_args = 2;
+        break;
+    case OP_MV_BASE:
+        insn.n_args = 1;
+        break;
+    default:
+        // I/O, halt and invalid opcodes are left to the interpreter
+        return insn;
+    }
+
+    long modes = val / 100;
+    for (int i = 0; i < 3; i++, modes /= 10) {
+        insn.modes[i] = modes % 10;
+        if (i < insn.n_args && (insn.modes[i] > ARG_MODE_REL || (i + 1 == write_arg && insn.modes[i] == ARG_MODE_IMM)))
+            return insn;
+    }
+    if ((size_t)addr + insn.n_args >= len)
+        return insn;
+
+    insn.op = val % 100;
+    return insn;
+}
+
+/* Compile the instruction at c->ip. Return false if it ends the block. */
+static bool
+compile_insn(JitCompiler *c, const JitInsn *insn) {
+    IntcodeJit *jit = c->jit;
+    if (jit->dynamic[c->ip]) {
+        emit_mem(c, true, 0x81, 7, REG_DATA, NO_INDEX, 0, c->ip * 8);
+        emit32(c, c->data[c->ip]);
+        emit_exit(c, 0x0f85, JIT_EXIT_STEP, c->ip, false, c->count);
+    } else {
+        g_array_append_val(c->covered, c->ip);
+    }
+
+    switch (insn->op) {
+    case OP_ADD: case OP_MUL: case OP_LESS: case OP_EQUAL:
+        emit_read(c, RAX, insn, 1);
+        emit_read(c, RCX, insn, 2);
+        if (insn->op == OP_ADD) {
+            emit_rr(c, 0x01, RCX, RAX);
+        } else if (insn->op == OP_MUL) {
+            emit_rr(c, 0x0faf, RAX, RCX);
+        } else {
+            emit_rr(c, 0x39, RCX, RAX);
+            emit_op(c, insn->op == OP_LESS ? 0x0f9c : 0x0f94);     // setl/sete al
+            emit8(c, 0xc0);
+            emit_op(c, 0x0fb6);     // movzx eax, al
+            emit8(c, 0xc0);
+        }
+        emit_write(c, insn, 3);
+        return true;
+
+    case OP_JUMP_TRUE: case OP_JUMP_FALSE: {
+        bool on_true = insn->op == OP_JUMP_TRUE;
+        long cond_cell = c->ip + 1, target_cell = c->ip + 2;
+        bool static_target = insn->modes[1] == ARG_MODE_IMM && !jit->dynamic[target_cell];
+        if (static_target)
+            g_array_append_val(c->covered, target_cell);
+        if (insn->modes[0] == ARG_MODE_IMM && !jit->dynamic[cond_cell]) {
+            g_array_append_val(c->covered, cond_cell);
+            if ((c->data[cond_cell] != 0) != on_true)
+                return true;
+            if (!static_target)
+                emit_read(c, RCX, insn, 2);
+            emit_jump(c, 0xe9, static_target, c->data[target_cell]);
+            return false;
+        }
+
+        emit_read(c, RAX, insn, 1);
+        if (!static_target)
+            emit_read(c, RCX, insn, 2);
+        emit_rr(c, 0x85, RAX, RAX);
+        emit_jump(c, on_true ? 0x0f85 : 0x0f84, static_target, c->data[target_cell]);
+        return true;
+    }
+
+    case OP_MV_BASE: {
+        long cell = c->ip + 1;
+        long val = c->data[cell];
+        if (insn->modes[0] == ARG_MODE_IMM && !jit->dynamic[cell] && val == (gint32)val) {
+            g_array_append_val(c->covered, cell);
+            emit_rex(c, true, 0, NO_INDEX, REG_RB);
+            emit8(c, 0x81);
+            emit8(c, 0xc0 | (REG_RB & 7));
+            emit32(c, val);
+            for (size_t i = 0; i < JIT_CACHE_SIZE; i++) {
+                if (c->cache[i].mode == ARG_MODE_REL)
+                    c->cache[i].addr -= val;
+            }
+        } else {
+            emit_read(c, RAX, insn, 1);
+            emit_rr(c, 0x01, RAX, REG_RB);
+            cache_forget_mode(c, ARG_MODE_REL);
+        }
+        return true;
+    }
+    }
+    g_assert_not_reached();
+}
+
+static void
+link_patch(guint8 *rel32, const guint8 *target) {
+    gint32 rel = target - (rel32 + 4);
+    memcpy(rel32, &rel, sizeof(rel));
+}
+
+/*
+ * Copy the block at start to the code memory, and link its exits with the
+ * blocks already compiled, in both directions. NULL if it doesn't fit.
+ */
+static JitFn
+jit_place(IntcodeJit *jit, const JitCompiler *c) {
+    const GByteArray *buf = c->buf;
+    if (jit->code == NULL) {
+        jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (jit->code == MAP_FAILED)
+            aoc_die("Intcode: can't map the JIT code memory\n");
+    }
+    if (jit->code_used + buf->len > JIT_CODE_SIZE)
+        return NULL;
+
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_WRITE) != 0)
+        aoc_die("Intcode: can't write the JIT code memory\n");
+    guint8 *fn = jit->code + jit->code_used;
+    memcpy(fn, buf->data, buf->len);
+    jit->body = c->body;
+
+    for (size_t i = 0; i < c->links->len; i++) {
+        JitLink link = g_array_index(c->links, JitLink, i);
+        link.rel32 = fn + link.pos;
+        if (link.target == c->start)
+            link_patch(link.rel32, fn + jit->body);
+        else if ((size_t)link.target < jit->len && jit->entries[link.target].fn != NULL)
+            link_patch(link.rel32, (guint8 *)jit->entries[link.target].fn + jit->body);
+        else
+            g_array_append_val(jit->links, link);
+    }
+    for (size_t i = 0; i < jit->links->len;) {
+        JitLink *link = &g_array_index(jit->links, JitLink, i);
+        if (link->target == c->start) {
+            link_patch(link->rel32, fn + jit->body);
+            g_array_remove_index_fast(jit->links, i);
+        } else {
+            i++;
+        }
+    }
+    if (mprotect(jit->code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) != 0)
+        aoc_die("Intcode: can't protect the JIT code memory\n");
+    jit->code_used += (buf->len + 15) & ~15ul;
+    return (JitFn)fn;
+}
+
+/* The native code of the block starting at start, or NULL if it can't start there */
+static JitFn
+jit_compile(Intcode *self, long start) {
+    JitCompiler c = {
+        .jit = self->jit,
+        .data = self->mem.data,
+        .len = self->mem.len,
+        .start = start,
+        .ip = start,
+        .buf = g_byte_array_new(),
+        .stubs = g_array_new(FALSE, FALSE, sizeof(JitStub)),
+        .covered = g_array_new(FALSE, FALSE, sizeof(long)),
+        .links = g_array_new(FALSE, FALSE, sizeof(JitLink)),
+    };
+    emit_prologue(&c);
+
+    bool open = true;
+    while (open) {
+        JitInsn insn = decode(c.data, c.len, c.ip);
+        if (insn.op == 0 || c.count == JIT_BLOCK_MAX) {
+            emit_exit(&c, 0xe9, insn.op == 0 ? JIT_EXIT_STEP : JIT_EXIT_NEXT, c.ip, false, c.count);
+            break;
+        }
+        open = compile_insn(&c, &insn);
+        c.ip += 1 + insn.n_args;
+        c.count++;
+    }
+
+    JitFn fn = NULL;
+    if (c.count > 0) {
+        emit_stubs_and_epilogue(&c);
+        fn = jit_place(c.jit, &c);
+        if (fn == NULL) {
+            intcode_jit_flush(c.jit);
+            fn = jit_place(c.jit, &c);
+        }
+        for (size_t i = 0; i < c.covered->len; i++)
+            c.jit->covered[g_array_index(c.covered, long, i)] = 1;
+    }
+
+    g_byte_array_free(c.buf, TRUE);
+    g_array_free(c.stubs, TRUE);
+    g_array_free(c.covered, TRUE);
+    g_array_free(c.links, TRUE);
+    return fn;
+}
+
+static void
+jit_reserve(IntcodeJit *jit, size_t len) {
+    if (len <= jit->len)
+        return;
+    size_t new_len = MAX(len, jit->len * 2);
+    jit->entries = g_renew(JitEntry, jit->entries, new_len);
+    jit->covered = g_renew(guint8, jit->covered, new_len);
+    jit->dynamic = g_renew(guint8, jit->dynamic, new_len);
+    memset(jit->entries + jit->len, 0, (new_len - jit->len) * sizeof(JitEntry));
+    memset(jit->covered + jit->len, 0, new_len - jit->len);
+    memset(jit->dynamic + jit->len, 0, new_len - jit->len);
+    jit->len = new_len;
+}
+
+bool
+intcode_jit_available(void) {
+    return true;
+}
+
+IntcodeJit *
+intcode_jit_new(void) {
+    IntcodeJit *jit = g_new0(IntcodeJit, 1);
+    jit->links = g_array_new(FALSE, FALSE, sizeof(JitLink));
+    return jit;
+}
+
+void
+intcode_jit_free(IntcodeJit *jit) {
+    if (jit == NULL)
+        return;
+    if (jit->code != NULL)
+        munmap(jit->code, JIT_CODE_SIZE);
+    g_free(jit->entries);
+    g_free(jit->covered);
+    g_free(jit->dynamic);
+    g_array_free(jit->links, TRUE);
+    g_free(jit);
+}
+
+void
+intcode_jit_flush(IntcodeJit *jit) {
+    memset(jit->entries, 0, jit->len * sizeof(JitEntry));
+    memset(jit->covered, 0, jit->len);
+    g_array_set_size(jit->links, 0);
+    jit->code_used = 0;
+}
+
+void
+intcode_jit_written(IntcodeJit *jit, long addr) {
+    if ((size_t)addr < jit->len && jit->covered[addr]) {
+        jit->dynamic[addr] = 1;
+        intcode_jit_flush(jit);
+    }
+}
+
+IntcodeState
+intcode_jit_run(Intcode *self) {
+    IntcodeJit *jit = self->jit;
+    IntcodeState state;
+
+    while (true) {
+        long ip = self->ip;
+        JitFn fn = NULL;
+        if ((size_t)ip < self->mem.len) {
+            jit_reserve(jit, self->mem.len);
+            JitEntry *entry = &jit->entries[ip];
+            if (entry->fn == NULL && entry->heat != JIT_NEVER && ++entry->heat >= INTCODE_JIT_HOT) {
+                // compiling can flush the entries, but not move them
+                entry->fn = jit_compile(self, ip);
+                if (entry->fn == NULL)
+                    entry->heat = JIT_NEVER;
+            }
+            fn = entry->fn;
+        }
+
+        if (fn != NULL) {
+            JitFrame frame = {
+                self->mem.data, self->mem.code, jit->covered, self->mem.len,
+                ip, self->rel_base, self->insn_count, -1, jit->entries, jit->len
+            };
+            JitExit exit = fn(&frame);
+            self->ip = frame.ip;
+            self->rel_base = frame.rel_base;
+            self->insn_count = frame.insn_count;
+            if (exit == JIT_EXIT_WRITE)
+                intcode_jit_written(jit, frame.written);
+            if (exit != JIT_EXIT_STEP)
+                continue;
+        }
+
+        if (!intcode_step(self, &state))
+            return state;
+    }
+}
+
+#else
+
+bool
+intcode_jit_available(void) {
+    return false;
+}
+
+IntcodeJit *
+intcode_jit_new(void) {
+    return NULL;
+}
+
+void
+intcode_jit_free(IntcodeJit *jit) {
+    (void)jit;
+}
+
+void
+intcode_jit_flush(IntcodeJit *jit) {
+    (void)jit;
+}
+
+void
+intcode_jit_written(IntcodeJit *jit, long addr) {
+    (void)jit;
+    (void)addr;
+}
+
+IntcodeState
+intcode_jit_run(Intcode *self) {
+    (void)self;
+    g_assert_not_reached();
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef INTCODE_JIT_H_
+#define INTCODE_JIT_H_
+
+#include "intcode.h"
+
+/*
+ * Interface of the JIT (intcode_jit.c) with the rest of the library, see
+ * intcode_set_jit.
+ */
+
+/* Empty JIT state of a computer, or NULL if the JIT isn't available */
+IntcodeJit *
+intcode_jit_new(void);
+
+void
+intcode_jit_free(IntcodeJit *jit);
+
+/* Like intcode_run, for a computer with the JIT enabled */
+IntcodeState
+intcode_jit_run(Intcode *self);
+
+/* Drop all the compiled code, because the memory was restored */
+void
+intcode_jit_flush(IntcodeJit *jit);
+
+/* The cell at addr was written outside of the compiled code */
+void
+intcode_jit_written(IntcodeJit *jit, long addr);
+
+#endif // INTCODE_JIT_H_